@@ -0,0 +1,66 @@
+//
+// MPMC throughput of t2::queue<mpmc> (CAS claims) and t2::scq_queue (fetch-and-add tickets)
+// with a growing number of producer threads and as many consumer threads.
+//
+//   g++ -std=c++11 -O2 -pthread -Iinclude benchmarks/mpmc_contention.cpp -o mpmc
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "queue.hpp"
+#include "scq_queue.hpp"
+
+static const uint16_t kCapacity = 1024;
+static const uint32_t kItems = 4000000;
+
+template <typename Queue>
+static double run_once(Queue &q, unsigned threads)
+{
+    std::atomic<uint32_t> popped{ 0 };
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&q, threads] {
+            for (uint32_t i = 0; i < kItems / threads;) {
+                if (q.try_push(i) == t2::State::SUCCESS) {
+                    i++;
+                }
+            }
+        });
+        workers.emplace_back([&q, &popped, threads] {
+            uint32_t value;
+            while (popped.load(std::memory_order_relaxed) < kItems / threads * threads) {
+                if (q.try_pop(value) == t2::State::SUCCESS) {
+                    popped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return kItems / threads * threads / elapsed.count();
+}
+
+int main()
+{
+    auto max_threads{ std::thread::hardware_concurrency() / 2 };
+    max_threads = max_threads > 0 ? max_threads : 1;
+
+    std::printf("threads  queue<mpmc>  scq_queue  (Mops/s)\n");
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        t2::queue<uint32_t, t2::dynamic_extent, uint16_t, t2::mpmc> cas{ kCapacity };
+        t2::scq_queue<uint32_t> scq{ kCapacity };
+        auto cas_ops = run_once(cas, threads);
+        auto scq_ops = run_once(scq, threads);
+        std::printf("%7u  %11.1f  %9.1f\n", threads, cas_ops / 1e6, scq_ops / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+//
+// SPSC throughput of t2::queue with both threads on node 0 and the ring on node 0 (local)
+// or on the last node (remote). The queue object, which holds the positions, is placed
+// on the node of the ring as well.
+//
+//   g++ -std=c++11 -O2 -pthread -Iinclude benchmarks/numa_placement.cpp -o numa
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "queue.hpp"
+
+#if defined(__linux__)
+#  include <pthread.h>
+#  include <sched.h>
+
+using queue_type = t2::queue<uint64_t, t2::dynamic_extent, uint32_t>;
+
+static const uint32_t kCapacity = 1 << 20;
+static const uint64_t kItems = 100000000;
+static const std::size_t kBatch = 64;
+static const int kRuns = 3;
+
+// cpus of a node from /sys, empty when there is no such node
+static std::vector<int> node_cpus(int node)
+{
+    std::vector<int> cpus;
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(in, list)) {
+        return cpus;
+    }
+    // e.g. 0-15,32-47
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        auto dash = range.find('-');
+        auto first = std::atoi(range.c_str());
+        auto last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+static void pin(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+static double run_once(int node, int producer_cpu, int consumer_cpu)
+{
+    // The positions of the queue object follow its memory.
+    t2::detail::page_buffer memory{ sizeof(queue_type), t2::Backing::PAGES, node };
+    auto q = ::new (memory.data()) queue_type{ kCapacity, t2::Backing::PAGES, node };
+
+    pin(pthread_self(), producer_cpu);
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([q] {
+        uint64_t buf[kBatch];
+        uint64_t expected{ 0 };
+        while (expected < kItems) {
+            auto n = q->try_pop_n(buf, kBatch);
+            for (std::size_t i = 0; i < n; i++, expected++) {
+                if (buf[i] != expected) {
+                    std::fprintf(stderr, "out of order: %llu != %llu\n",
+                                 (unsigned long long)buf[i], (unsigned long long)expected);
+                    std::abort();
+                }
+            }
+        }
+    });
+    pin(consumer.native_handle(), consumer_cpu);
+
+    uint64_t buf[kBatch];
+    for (uint64_t i = 0; i < kItems;) {
+        for (std::size_t k = 0; k < kBatch; k++) {
+            buf[k] = i + k;
+        }
+        auto left{ kItems - i };
+        i += q->try_push_n(buf, buf + (left < kBatch ? left : kBatch));
+    }
+    consumer.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (q->node() != node) {
+        std::fprintf(stderr, "the ring is on node %d, not on node %d\n", q->node(), node);
+    }
+    q->~queue_type();
+    return kItems / elapsed.count();
+}
+
+int main()
+{
+    auto local = node_cpus(0);
+    int remote_node{ 0 };
+    while (!node_cpus(remote_node + 1).empty()) {
+        remote_node++;
+    }
+    if (local.empty()) {
+        std::printf("no NUMA information in /sys\n");
+        return 0;
+    }
+    auto producer_cpu = local[0];
+    auto consumer_cpu = local.size() > 1 ? local[1] : local[0];
+    std::printf("threads on cpus %d and %d of node 0\n", producer_cpu, consumer_cpu);
+    if (remote_node == 0) {
+        std::printf("single node, remote placement is not measured\n");
+    }
+
+    std::printf("ring on  node  Mops/s\n");
+    for (int node = 0; node <= remote_node; node += remote_node > 0 ? remote_node : 1) {
+        double best{ 0 };
+        for (int i = 0; i < kRuns; i++) {
+            auto ops = run_once(node, producer_cpu, consumer_cpu);
+            best = ops > best ? ops : best;
+        }
+        std::printf("%-6s  %4d  %6.1f\n", node == 0 ? "local" : "remote", node, best / 1e6);
+    }
+    return 0;
+}
+#else
+int main()
+{
+    std::printf("NUMA placement needs Linux\n");
+    return 0;
+}
+#endif
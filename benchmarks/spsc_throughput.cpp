@@ -0,0 +1,71 @@
+//
+// SPSC throughput of t2::queue: one producer thread pushes, one consumer thread pops.
+//
+// It compares len() derived from the positions (t2::spsc) with the exact counter
+// (t2::counted<t2::spsc>):
+//   g++ -std=c++11 -O2 -pthread -Iinclude benchmarks/spsc_throughput.cpp -o spsc
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "queue.hpp"
+
+static const uint16_t kCapacity = 1024;
+static const uint32_t kItems = 10000000;
+static const int kRuns = 5;
+
+template <typename Policy>
+static double run_once()
+{
+    t2::queue<uint32_t, t2::dynamic_extent, uint16_t, Policy> q{ kCapacity };
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&q] {
+        uint32_t expected{ 0 };
+        while (expected < kItems) {
+            uint32_t value;
+            t2::State state;
+            std::tie(value, state) = q.try_pop();
+            if (state == t2::State::SUCCESS) {
+                if (value != expected) {
+                    std::fprintf(stderr, "out of order: %u != %u\n", value, expected);
+                    std::abort();
+                }
+                expected++;
+            }
+        }
+    });
+
+    for (uint32_t i = 0; i < kItems;) {
+        if (q.try_push(i) == t2::State::SUCCESS) {
+            i++;
+        }
+    }
+    consumer.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return kItems / elapsed.count();
+}
+
+template <typename Policy>
+static void run(const char *name)
+{
+    std::printf("len(): %s\n", name);
+    double best{ 0 };
+    for (int i = 0; i < kRuns; i++) {
+        auto ops = run_once<Policy>();
+        std::printf("run %d: %.1f Mops/s\n", i, ops / 1e6);
+        best = ops > best ? ops : best;
+    }
+    std::printf("best: %.1f Mops/s\n", best / 1e6);
+}
+
+int main()
+{
+    run<t2::spsc>("derived from positions");
+    run<t2::counted<t2::spsc>>("shared counter");
+    return 0;
+}
@@ -6,15 +6,17 @@
 #include <Arduino.h>
 #include "queue.hpp"
 
-t2::queue<int32_t> q{1024};
+// The consumer parks while the queue is empty instead of spinning on the core.
+t2::queue<int32_t, t2::dynamic_extent, uint16_t, t2::spsc, t2::futex_park> q{1024};
 int32_t count{1};
 
 TaskHandle_t core2Task;  // Task handle for the second core
 
 void core2_function(void* parameter) {
     auto i = 1024;
+    int32_t value;
     while (i > 0) {
-        if (q.try_pop() != 0) {
+        if (q.pop_wait(value) == t2::State::SUCCESS) {
             i--;
         }
     }
@@ -38,6 +40,7 @@ void setup() {
 
 void loop() {
     // Your main loop code running on Core 1
-    q.try_push(count);
-    count++;
+    if (q.push_wait(count) == t2::State::SUCCESS) {
+        count++;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,197 @@
+//
+// SPSC ring of variable-length byte records (bip buffer).
+//
+
+#ifndef BIP_BUFFER_HPP
+#define BIP_BUFFER_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <tuple>
+
+#include "cache_padded.h"
+#include "queue.hpp"
+
+namespace t2 {
+// Byte ring for one producer thread and one consumer thread.
+// A record is a length header followed by its bytes, both contiguous in the buffer:
+// when a record does not fit before the end of the buffer, the producer leaves the tail
+// unused, marks it with the watermark and starts again at offset 0.
+// The producer writes a record in place with reserve() and commit(),
+// the consumer reads it in place with try_read() and release().
+class bip_buffer
+{
+private:
+    using header_type = uint32_t;
+
+    // records start on this boundary, their bytes follow the header at the next one
+    static const std::size_t kAlign = 8;
+
+    static std::size_t record_size(std::size_t len) noexcept
+    {
+        return kAlign + (len + kAlign - 1) / kAlign * kAlign;
+    }
+
+    // Read-only after construction.
+    std::size_t cap_;
+
+    std::unique_ptr<unsigned char[]> buf_;
+
+    // Producer-owned.
+    // offset of the next record
+    alignas(CACHE_PADDED) std::atomic<std::size_t> write_{ 0 };
+    // end of the records before the producer went back to offset 0,
+    // only read by the consumer while write_ is behind read_
+    std::atomic<std::size_t> watermark_{ 0 };
+    // record handed out by reserve() and not yet committed
+    std::size_t reserved_{ 0 };
+    std::size_t reserved_len_{ 0 };
+    bool reserving_{ false };
+
+    // Consumer-owned.
+    // offset of the front record, released or not
+    alignas(CACHE_PADDED) std::atomic<std::size_t> read_{ 0 };
+    // record returned by try_read() and not yet released
+    std::size_t front_{ 0 };
+
+    alignas(CACHE_PADDED) std::atomic<bool> closed_{ false };
+
+    // offset of the front record, or cap_ when there is none
+    std::size_t front() const noexcept
+    {
+        auto r{ read_.load(std::memory_order_relaxed) };
+        auto w{ write_.load(std::memory_order_acquire) };
+        if (r == w) {
+            return cap_;
+        }
+        if (w < r && r == watermark_.load(std::memory_order_relaxed)) {
+            // The records up to the watermark are read, go on at offset 0.
+            return 0;
+        }
+        return r;
+    }
+
+public:
+    // A buffer of cap bytes, rounded down to a multiple of 8.
+    explicit bip_buffer(std::size_t cap)
+        : cap_{ cap / kAlign * kAlign }, buf_{ new unsigned char[cap / kAlign * kAlign] }
+    {
+        assert(cap_ >= 2 * kAlign);
+    }
+
+    bip_buffer(const bip_buffer &) = delete;
+    bip_buffer &operator=(const bip_buffer &) = delete;
+
+    // Claim len contiguous bytes for a record,
+    // return nullptr when the buffer is full or closed.
+    // Records of more than half of the capacity may never fit.
+    // The record is not visible to the consumer until commit() is called,
+    // only one record can be reserved at a time.
+    void *reserve(std::size_t len)
+    {
+        assert(!reserving_);
+        if (closed_.load(std::memory_order_relaxed) || len > UINT32_MAX) {
+            return nullptr;
+        }
+
+        auto total{ record_size(len) };
+        auto w{ write_.load(std::memory_order_relaxed) };
+        auto r{ read_.load(std::memory_order_acquire) };
+        if (w >= r) {
+            // The records are in [r, w), the free space is [w, cap_) and [0, r).
+            if (cap_ - w >= total) {
+                reserved_ = w;
+            } else if (r > total) {
+                // Keep write_ from catching up with read_, they are equal when empty.
+                reserved_ = 0;
+            } else {
+                return nullptr;
+            }
+        } else if (r - w > total) {
+            // The records are in [r, watermark) and [0, w), the free space is [w, r).
+            reserved_ = w;
+        } else {
+            return nullptr;
+        }
+        reserved_len_ = len;
+        reserving_ = true;
+        return buf_.get() + reserved_ + kAlign;
+    }
+
+    // Publish the record returned by reserve() with its first len bytes,
+    // len must not exceed the reserved length.
+    void commit(std::size_t len)
+    {
+        assert(reserving_ && len <= reserved_len_);
+        auto w{ write_.load(std::memory_order_relaxed) };
+        auto header{ (header_type)len };
+        std::memcpy(buf_.get() + reserved_, &header, sizeof(header));
+        if (reserved_ != w) {
+            watermark_.store(w, std::memory_order_relaxed);
+        }
+        write_.store(reserved_ + record_size(len), std::memory_order_release);
+        reserving_ = false;
+    }
+
+    void commit() { this->commit(reserved_len_); }
+
+    // Copy len bytes from data into a new record.
+    State try_push(const void *data, std::size_t len)
+    {
+        if (closed_.load(std::memory_order_relaxed)) {
+            return State::CLOSED;
+        }
+        auto dst = this->reserve(len);
+        if (dst == nullptr) {
+            return State::FULL;
+        }
+        std::memcpy(dst, data, len);
+        this->commit(len);
+        return State::SUCCESS;
+    }
+
+    // Return the bytes and the length of the front record without removing it.
+    // They stay valid until release() hands the record back to the producer.
+    // Return CLOSED once the buffer is closed and drained.
+    std::tuple<const unsigned char *, std::size_t, State> try_read()
+    {
+        front_ = this->front();
+        if (front_ == cap_ && closed_.load(std::memory_order_acquire)) {
+            // Retry once, the records committed before close() are visible now.
+            front_ = this->front();
+            if (front_ == cap_) {
+                return std::make_tuple(nullptr, 0, State::CLOSED);
+            }
+        }
+        if (front_ == cap_) {
+            return std::make_tuple(nullptr, 0, State::EMPTY);
+        }
+
+        header_type len;
+        std::memcpy(&len, buf_.get() + front_, sizeof(len));
+        return std::make_tuple(buf_.get() + front_ + kAlign, (std::size_t)len, State::SUCCESS);
+    }
+
+    // Remove the record returned by the last successful try_read().
+    void release()
+    {
+        header_type len;
+        std::memcpy(&len, buf_.get() + front_, sizeof(len));
+        read_.store(front_ + record_size(len), std::memory_order_release);
+    }
+
+    // Pushes return CLOSED from then on, reads return CLOSED once the buffer is drained.
+    // Call it from the producer thread.
+    void close() noexcept { closed_.store(true, std::memory_order_release); }
+
+    std::size_t capacity() const noexcept { return cap_; }
+
+    bool is_close() const noexcept { return closed_.load(std::memory_order_relaxed); }
+};
+} // namespace t2
+
+#endif // BIP_BUFFER_HPP
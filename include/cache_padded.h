@@ -5,7 +5,11 @@
 #ifndef QUEUE_CACHE_PADDED_H
 #define QUEUE_CACHE_PADDED_H
 
+#include <cstddef>
 #include <cstdint>
+#if defined(T2_USE_HARDWARE_INTERFERENCE_SIZE)
+#  include <new>
+#endif
 
 #if defined(ESP32)
 #  define CACHE_PADDED \
@@ -13,8 +17,20 @@
 #elif defined(ARDUINO_PORTENTA_H7_M7)
 #  define CACHE_PADDED \
       32 // https://forum.arduino.cc/t/data-caching-for-multicore-shared-data/1046357/4
+#elif defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+// Intel's spatial prefetcher pulls 64-byte lines in pairs, so two fields only stop
+// false sharing when they are 128 bytes apart. std::hardware_destructive_interference_size
+// reports a single line here, and GCC's value also moves with -mtune.
+#  define CACHE_PADDED 128
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__powerpc64__)
+// Apple M-series and POWER have 128-byte lines, Neoverse cores prefetch 64-byte pairs.
+#  define CACHE_PADDED 128
+#elif defined(T2_USE_HARDWARE_INTERFERENCE_SIZE) && defined(__cpp_lib_hardware_interference_size)
+// Opt-in: the value depends on the compiler and on -mtune, so every translation unit (and
+// every process mapping a t2::shm_queue) has to be built with the same flags.
+#  define CACHE_PADDED std::hardware_destructive_interference_size
 #else
-#  define CACHE_PADDED sizeof(uint32_t)
+#  define CACHE_PADDED 64
 #endif
 
 #endif // QUEUE_CACHE_PADDED_H
@@ -0,0 +1,188 @@
+//
+// Readiness scan of the dense lap array of t2::queue.
+//
+
+#ifndef LAP_SCAN_HPP
+#define LAP_SCAN_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// ThreadSanitizer sees the vector loads as plain reads racing with the producers' stores
+// and does not model the acquire fence after them, so it gets the scalar acquire loads.
+#if defined(__SANITIZE_THREAD__)
+#  define T2_LAP_SCAN_TSAN
+#elif defined(__has_feature)
+#  if __has_feature(thread_sanitizer)
+#    define T2_LAP_SCAN_TSAN
+#  endif
+#endif
+
+#if defined(T2_LAP_SCAN_TSAN)
+// scalar scan only
+#elif defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  include <immintrin.h>
+#  define T2_LAP_SCAN_AVX2
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define T2_LAP_SCAN_NEON
+#endif
+
+namespace t2 {
+namespace detail {
+// Number of leading laps of laps[0 .. n) that are equal to lap, one load per lap.
+// The loads are relaxed, the caller orders the value reads with an acquire fence.
+template <typename Lap>
+std::size_t count_laps_scalar(const std::atomic<Lap> *laps, Lap lap, std::size_t n) noexcept
+{
+#if defined(T2_LAP_SCAN_TSAN)
+    const auto order = std::memory_order_acquire;
+#else
+    const auto order = std::memory_order_relaxed;
+#endif
+    std::size_t i{ 0 };
+    while (i < n && laps[i].load(order) == lap) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(T2_LAP_SCAN_AVX2)
+// Compare 32 bytes of laps at a time.
+// The AVX2 functions are compiled for AVX2 only, count_laps checks the cpu before calling them.
+template <std::size_t Size>
+struct avx2_lanes;
+
+template <>
+struct avx2_lanes<1>
+{
+    __attribute__((target("avx2"))) static __m256i set1(uint8_t v) noexcept
+    {
+        return _mm256_set1_epi8((char)v);
+    }
+
+    __attribute__((target("avx2"))) static __m256i cmpeq(__m256i a, __m256i b) noexcept
+    {
+        return _mm256_cmpeq_epi8(a, b);
+    }
+};
+
+template <>
+struct avx2_lanes<2>
+{
+    __attribute__((target("avx2"))) static __m256i set1(uint16_t v) noexcept
+    {
+        return _mm256_set1_epi16((short)v);
+    }
+
+    __attribute__((target("avx2"))) static __m256i cmpeq(__m256i a, __m256i b) noexcept
+    {
+        return _mm256_cmpeq_epi16(a, b);
+    }
+};
+
+template <>
+struct avx2_lanes<4>
+{
+    __attribute__((target("avx2"))) static __m256i set1(uint32_t v) noexcept
+    {
+        return _mm256_set1_epi32((int)v);
+    }
+
+    __attribute__((target("avx2"))) static __m256i cmpeq(__m256i a, __m256i b) noexcept
+    {
+        return _mm256_cmpeq_epi32(a, b);
+    }
+};
+
+template <typename Lap>
+__attribute__((target("avx2"))) std::size_t count_laps_avx2(const std::atomic<Lap> *laps,
+                                                             Lap lap,
+                                                             std::size_t n) noexcept
+{
+    const std::size_t kStep = 32 / sizeof(Lap);
+    auto want = avx2_lanes<sizeof(Lap)>::set1(lap);
+    std::size_t i{ 0 };
+    for (; i + kStep <= n; i += kStep) {
+        auto got = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(laps + i));
+        auto equal = (uint32_t)_mm256_movemask_epi8(avx2_lanes<sizeof(Lap)>::cmpeq(got, want));
+        if (equal != ~uint32_t{ 0 }) {
+            // Each lap sets sizeof(Lap) bits of the mask.
+            return i + (std::size_t)__builtin_ctz(~equal) / sizeof(Lap);
+        }
+    }
+    return i + count_laps_scalar(laps + i, lap, n - i);
+}
+
+inline bool has_avx2() noexcept
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+#if defined(T2_LAP_SCAN_NEON)
+// Compare 16 bytes of laps at a time.
+inline uint8x16_t neon_cmpeq(const std::atomic<uint8_t> *laps, uint8_t lap) noexcept
+{
+    return vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(laps)), vdupq_n_u8(lap));
+}
+
+inline uint8x16_t neon_cmpeq(const std::atomic<uint16_t> *laps, uint16_t lap) noexcept
+{
+    auto equal = vceqq_u16(vld1q_u16(reinterpret_cast<const uint16_t *>(laps)), vdupq_n_u16(lap));
+    return vreinterpretq_u8_u16(equal);
+}
+
+inline uint8x16_t neon_cmpeq(const std::atomic<uint32_t> *laps, uint32_t lap) noexcept
+{
+    auto equal = vceqq_u32(vld1q_u32(reinterpret_cast<const uint32_t *>(laps)), vdupq_n_u32(lap));
+    return vreinterpretq_u8_u32(equal);
+}
+
+template <typename Lap>
+std::size_t count_laps_neon(const std::atomic<Lap> *laps, Lap lap, std::size_t n) noexcept
+{
+    const std::size_t kStep = 16 / sizeof(Lap);
+    std::size_t i{ 0 };
+    for (; i + kStep <= n; i += kStep) {
+        auto equal = neon_cmpeq(laps + i, lap);
+        if (vminvq_u8(equal) == 0) {
+            // Narrow each byte to 4 bits of a 64-bit mask, each lap sets 4 * sizeof(Lap) bits.
+            auto nibbles = vshrn_n_u16(vreinterpretq_u16_u8(equal), 4);
+            auto mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+            return i + (std::size_t)__builtin_ctzll(~mask) / (4 * sizeof(Lap));
+        }
+    }
+    return i + count_laps_scalar(laps + i, lap, n - i);
+}
+#endif
+
+// Number of leading laps of laps[0 .. n) that are equal to lap,
+// compared a vector at a time where the cpu has one.
+// The vector loads are not atomic loads in the C++ model, they assume that each lane, a
+// naturally aligned lap, is read single-copy atomically. That holds for the AVX2 path on
+// x86-64 and the NEON path on AArch64 (LD1 is single-copy atomic per element), other targets
+// use the scalar loads. A lane may be older or newer than its neighbours, but never a mix of
+// two laps. The caller orders the value reads with an acquire fence.
+template <typename Lap>
+std::size_t count_laps(const std::atomic<Lap> *laps, Lap lap, std::size_t n) noexcept
+{
+    static_assert(sizeof(std::atomic<Lap>) == sizeof(Lap), "laps have to be dense");
+#if defined(T2_LAP_SCAN_AVX2)
+#  if defined(__AVX2__)
+    return count_laps_avx2(laps, lap, n);
+#  else
+    return has_avx2() ? count_laps_avx2(laps, lap, n) : count_laps_scalar(laps, lap, n);
+#  endif
+#elif defined(T2_LAP_SCAN_NEON)
+    return count_laps_neon(laps, lap, n);
+#else
+    return count_laps_scalar(laps, lap, n);
+#endif
+}
+} // namespace detail
+} // namespace t2
+
+#endif // LAP_SCAN_HPP
@@ -0,0 +1,77 @@
+//
+// Ring buffer memory mapped twice back to back (Linux).
+//
+
+#ifndef MIRROR_BUFFER_HPP
+#define MIRROR_BUFFER_HPP
+
+#if defined(__linux__)
+
+#include <cstddef>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace t2 {
+// size bytes of memory followed by a second mapping of the same pages,
+// so data()[i] and data()[i + size] are the same byte and any window of up to size bytes
+// from an offset below size is contiguous, with no split at the end of the ring.
+class mirror_buffer
+{
+    unsigned char *data_{ nullptr };
+    std::size_t size_{ 0 };
+
+public:
+    static std::size_t page_size() noexcept { return (std::size_t)::sysconf(_SC_PAGESIZE); }
+
+    // size have to be a multiple of page_size(),
+    // data() is nullptr when the pages cannot be mapped.
+    explicit mirror_buffer(std::size_t size) noexcept
+    {
+        auto fd{ ::memfd_create("t2_mirror", MFD_CLOEXEC) };
+        if (fd < 0) {
+            return;
+        }
+        if (size == 0 || size % page_size() != 0 || ::ftruncate(fd, (off_t)size) != 0) {
+            ::close(fd);
+            return;
+        }
+
+        // Reserve both halves first, so the second mapping cannot land on anything else.
+        auto base = ::mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            ::close(fd);
+            return;
+        }
+        auto lo = ::mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        auto hi = ::mmap(static_cast<unsigned char *>(base) + size, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FIXED, fd, 0);
+        // The mappings keep the pages alive.
+        ::close(fd);
+        if (lo == MAP_FAILED || hi == MAP_FAILED) {
+            ::munmap(base, 2 * size);
+            return;
+        }
+        data_ = static_cast<unsigned char *>(base);
+        size_ = size;
+    }
+
+    mirror_buffer(const mirror_buffer &) = delete;
+    mirror_buffer &operator=(const mirror_buffer &) = delete;
+
+    ~mirror_buffer()
+    {
+        if (data_ != nullptr) {
+            ::munmap(data_, 2 * size_);
+        }
+    }
+
+    unsigned char *data() const noexcept { return data_; }
+
+    std::size_t size() const noexcept { return size_; }
+};
+} // namespace t2
+
+#endif // __linux__
+
+#endif // MIRROR_BUFFER_HPP
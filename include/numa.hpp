@@ -0,0 +1,82 @@
+//
+// NUMA placement of the ring buffers, a shim over the Linux memory policy system calls.
+//
+
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <cstddef>
+
+#if defined(__linux__)
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+namespace t2 {
+// NUMA node of a ring buffer: a node number or one of these.
+// the pages land on the node of the thread that first touches them
+static const int kAnyNode = -1;
+// the node of the constructing thread
+static const int kLocalNode = -2;
+
+namespace detail {
+// The system calls are made directly, so libnuma is not needed.
+// Values of <numaif.h>.
+static const int kMpolPreferred = 1;
+
+// node of the calling thread, 0 when unknown
+inline int numa_current_node() noexcept
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu;
+    unsigned node;
+    if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+        return (int)node;
+    }
+#endif
+    return 0;
+}
+
+// Prefer node for the pages of [addr, addr + len), addr is page-aligned.
+// Only pages that are not touched yet follow the policy.
+inline bool numa_prefer(void *addr, std::size_t len, int node) noexcept
+{
+    if (node == kLocalNode) {
+        node = numa_current_node();
+    }
+#if defined(__linux__) && defined(SYS_mbind)
+    const std::size_t kBits = sizeof(unsigned long) * 8;
+    unsigned long mask[16] = {};
+    if (node < 0 || (std::size_t)node >= sizeof(mask) * 8) {
+        return false;
+    }
+    mask[node / kBits] = 1ul << (node % kBits);
+    // The kernel reads one bit less than maxnode.
+    return ::syscall(SYS_mbind, addr, len, kMpolPreferred, mask, sizeof(mask) * 8 + 1, 0) == 0;
+#else
+    (void)addr;
+    (void)len;
+    return false;
+#endif
+}
+
+// node of the page at addr, -1 when unknown or not touched yet
+// move_pages without target nodes only reports where the page is, it does not fault it in,
+// a page that is not present comes back as -ENOENT.
+inline int numa_node_of(const void *addr) noexcept
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+    const void *pages[1] = { addr };
+    int status[1] = { -1 };
+    if (::syscall(SYS_move_pages, 0, 1, pages, nullptr, status, 0) == 0 && status[0] >= 0) {
+        return status[0];
+    }
+#else
+    (void)addr;
+#endif
+    return -1;
+}
+} // namespace detail
+} // namespace t2
+
+#endif // NUMA_HPP
@@ -0,0 +1,143 @@
+//
+// Page-backed memory of the ring buffers.
+//
+
+#ifndef PAGE_BUFFER_HPP
+#define PAGE_BUFFER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include "numa.hpp"
+
+namespace t2 {
+// Memory of a ring buffer, as requested and as obtained.
+enum class Backing : int8_t {
+    // global new
+    HEAP = 0,
+    // anonymous mapping of base pages
+    PAGES = 1,
+    // 2 MB pages of the hugetlbfs pool (MAP_HUGETLB)
+    HUGE_PAGES = 2,
+    // base pages with madvise(MADV_HUGEPAGE), the kernel merges them into huge pages
+    TRANSPARENT_HUGE_PAGES = 3,
+};
+
+namespace detail {
+// At least size bytes of zeroed anonymous memory with the closest backing to the requested one,
+// HUGE_PAGES falls back to TRANSPARENT_HUGE_PAGES, which falls back to PAGES.
+// A node other than kAnyNode maps PAGES for HEAP, the pages prefer that node.
+// data() is nullptr for HEAP, off Linux, or when nothing can be mapped.
+class page_buffer
+{
+    void *data_{ nullptr };
+    std::size_t size_{ 0 };
+    Backing backing_{ Backing::HEAP };
+
+public:
+    static const std::size_t kHugePage = std::size_t{ 2 } << 20;
+
+    static std::size_t round_up(std::size_t size, std::size_t page) noexcept
+    {
+        return (size + page - 1) / page * page;
+    }
+
+    page_buffer() noexcept = default;
+
+#if defined(__linux__)
+    page_buffer(std::size_t size, Backing want, int node = kAnyNode) noexcept
+    {
+        if (size == 0 || (want == Backing::HEAP && node == kAnyNode)) {
+            return;
+        }
+        if (want == Backing::HEAP) {
+            // mbind only applies to whole pages.
+            want = Backing::PAGES;
+        }
+        this->map(size, want);
+        if (data_ != nullptr && node != kAnyNode) {
+            numa_prefer(data_, size_, node);
+        }
+    }
+
+    ~page_buffer()
+    {
+        if (data_ != nullptr) {
+            ::munmap(data_, size_);
+        }
+    }
+#else
+    page_buffer(std::size_t, Backing, int = kAnyNode) noexcept { }
+#endif
+
+    page_buffer(const page_buffer &) = delete;
+    page_buffer &operator=(const page_buffer &) = delete;
+
+    void *data() const noexcept { return data_; }
+
+    std::size_t size() const noexcept { return size_; }
+
+    Backing backing() const noexcept { return backing_; }
+
+private:
+#if defined(__linux__)
+    void map(std::size_t size, Backing want) noexcept
+    {
+        auto prot{ PROT_READ | PROT_WRITE };
+        auto flags{ MAP_PRIVATE | MAP_ANONYMOUS };
+
+        if (want == Backing::HUGE_PAGES) {
+            auto len{ round_up(size, kHugePage) };
+            auto p = ::mmap(nullptr, len, prot, flags | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                data_ = p;
+                size_ = len;
+                backing_ = Backing::HUGE_PAGES;
+                return;
+            }
+            // The pool is empty or not configured.
+            want = Backing::TRANSPARENT_HUGE_PAGES;
+        }
+
+#  if defined(MADV_HUGEPAGE)
+        if (want == Backing::TRANSPARENT_HUGE_PAGES) {
+            // Map one huge page more and trim it,
+            // so the buffer starts on a huge page boundary and can be merged from the start.
+            auto len{ round_up(size, kHugePage) };
+            auto p = ::mmap(nullptr, len + kHugePage, prot, flags, -1, 0);
+            if (p != MAP_FAILED) {
+                auto start{ reinterpret_cast<uintptr_t>(p) };
+                auto aligned{ (uintptr_t)round_up(start, kHugePage) };
+                if (aligned != start) {
+                    ::munmap(p, aligned - start);
+                }
+                ::munmap(reinterpret_cast<void *>(aligned + len), start + kHugePage - aligned);
+                data_ = reinterpret_cast<void *>(aligned);
+                size_ = len;
+                backing_ = ::madvise(data_, len, MADV_HUGEPAGE) == 0
+                               ? Backing::TRANSPARENT_HUGE_PAGES
+                               : Backing::PAGES;
+                return;
+            }
+        }
+#  endif
+
+        auto len{ round_up(size, (std::size_t)::sysconf(_SC_PAGESIZE)) };
+        auto p = ::mmap(nullptr, len, prot, flags, -1, 0);
+        if (p != MAP_FAILED) {
+            data_ = p;
+            size_ = len;
+            backing_ = Backing::PAGES;
+        }
+    }
+#endif
+};
+} // namespace detail
+} // namespace t2
+
+#endif // PAGE_BUFFER_HPP
@@ -7,11 +7,28 @@
 
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <stdexcept>
 #include <tuple>
 #include <type_traits>
 
+#if __cplusplus >= 201703L && defined(__has_include)
+#  if __has_include(<memory_resource>)
+#    include <memory_resource>
+#    define T2_QUEUE_PMR
+#  endif
+#endif
+
 #include "cache_padded.h"
+#include "lap_scan.hpp"
+#include "mirror_buffer.hpp"
+#include "page_buffer.hpp"
+#include "wait_strategy.hpp"
 
 namespace t2 {
 static const uint16_t kMask16 = 1 << 15;
@@ -24,209 +41,1490 @@ enum class State : int8_t {
     CLOSED = -3,
 };
 
-template <typename T>
-class queue
+// Concurrency policies of a queue.
+// A single side uses plain loads and stores of its position,
+// multiple threads on a side claim elements with a CAS on the position.
+// spsc: one producer thread and one consumer thread.
+struct spsc
+{
+    static const bool multi_producer = false;
+    static const bool multi_consumer = false;
+    static const bool cached_index = false;
+    static const bool size_counter = false;
+};
+
+// mpsc: any number of producer threads, one consumer thread.
+struct mpsc
+{
+    static const bool multi_producer = true;
+    static const bool multi_consumer = false;
+    static const bool cached_index = false;
+    static const bool size_counter = false;
+};
+
+// spmc: one producer thread, any number of consumer threads.
+struct spmc
+{
+    static const bool multi_producer = false;
+    static const bool multi_consumer = true;
+    static const bool cached_index = false;
+    static const bool size_counter = false;
+};
+
+// mpmc: any number of producer and consumer threads.
+struct mpmc
+{
+    static const bool multi_producer = true;
+    static const bool multi_consumer = true;
+    static const bool cached_index = false;
+    static const bool size_counter = false;
+};
+
+// spsc_cached: spsc where each side keeps a private copy of the opposite position
+// and only reads the shared position when that copy says the ring is full (empty).
+// The slot laps are not used, so they are not allocated.
+struct spsc_cached
+{
+    static const bool multi_producer = false;
+    static const bool multi_consumer = false;
+    static const bool cached_index = true;
+    static const bool size_counter = false;
+};
+
+// counted<Policy>: Policy with an exact element counter that every push and pop updates.
+// By default len() is derived from the positions, which keeps read-modify-write
+// instructions off the push/pop path.
+template <typename Policy>
+struct counted : Policy
+{
+    static const bool size_counter = true;
+};
+
+// Element layouts of a queue.
+// soa: the laps and the values are kept in two dense arrays. A lap is 1 to 4 bytes
+// next to a value of any size, runs of values are contiguous and a batch scans the laps
+// without loading the values.
+struct soa
+{
+};
+
+// aos: each lap is stored next to its value, a push or a pop touches a single cache line
+// when the element fits in one.
+struct aos
+{
+};
+
+#if defined(__linux__)
+// mirror: soa with the values in a mirror_buffer, the elements from any index on are
+// contiguous up to the capacity. The values have to fill whole pages.
+struct mirror
+{
+};
+#endif
+
+// Capacity of a queue that is chosen at run time.
+static const std::size_t dynamic_extent = 0;
+
+namespace detail {
+// Position and lap types for an index type.
+// A position holds, from the top bit down, a spare bit that is kept clear,
+// the current round over the ring buffer and the index of the element.
+// A lap is the round doubled, so it has one more bit than the round and both wrap together.
+template <typename Index>
+struct index_traits;
+
+template <>
+struct index_traits<uint8_t>
+{
+    using position_type = uint16_t;
+    using lap_type = uint8_t;
+    static const unsigned index_bits = 8;
+};
+
+template <>
+struct index_traits<uint16_t>
+{
+    using position_type = uint32_t;
+    using lap_type = uint16_t;
+    static const unsigned index_bits = 16;
+};
+
+template <>
+struct index_traits<uint32_t>
+{
+    using position_type = uint64_t;
+    using lap_type = uint32_t;
+    static const unsigned index_bits = 32;
+};
+
+// There is no wider atomic position, 40 bits go to the index
+// and the 23-bit round wraps the lap at 24 bits.
+template <>
+struct index_traits<uint64_t>
+{
+    using position_type = uint64_t;
+    using lap_type = uint32_t;
+    static const unsigned index_bits = 40;
+};
+
+// mask of the lap values for a round of round_bits bits
+template <typename Lap>
+constexpr Lap lap_mask(unsigned round_bits) noexcept
+{
+    return round_bits + 1 >= sizeof(Lap) * 8 ? (Lap)~Lap{ 0 } : (Lap)((1u << (round_bits + 1)) - 1);
+}
+
+// Position arithmetic of a ring buffer with N elements.
+template <typename Index, std::size_t N>
+class extent
+{
+public:
+    using position_type = typename index_traits<Index>::position_type;
+    using lap_type = typename index_traits<Index>::lap_type;
+
+private:
+    static constexpr unsigned log2(std::size_t n) noexcept { return n == 1 ? 0 : 1 + log2(n >> 1); }
+
+    static const unsigned kPositionBits = sizeof(position_type) * 8;
+
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N have to be a power of two");
+    static_assert(log2(N) < index_traits<Index>::index_bits, "N have to fit in the index type");
+
+public:
+    static constexpr Index capacity() noexcept { return N; }
+
+    static constexpr position_type spare_bit() noexcept
+    {
+        return (position_type)(position_type{ 1 } << (kPositionBits - 1));
+    }
+
+    static constexpr lap_type lap_mask() noexcept
+    {
+        return detail::lap_mask<lap_type>(kPositionBits - 1 - log2(N));
+    }
+
+    // Positions are free-running counters,
+    // the index is masked out of them so there is no wrap-around branch.
+    static Index index(position_type x) noexcept { return (Index)(x & (N - 1)); }
+
+    static position_type round(position_type x) noexcept
+    {
+        return (position_type)(x & ~spare_bit()) >> log2(N);
+    }
+
+    static position_type next(position_type x) noexcept
+    {
+        return (position_type)((x + 1) & ~spare_bit());
+    }
+
+    // position n elements after x, n <= N
+    static position_type advance(position_type x, Index n) noexcept
+    {
+        return (position_type)((x + n) & ~spare_bit());
+    }
+
+    static position_type distance(position_type send, position_type recv) noexcept
+    {
+        return (position_type)((send - recv) & ~spare_bit());
+    }
+};
+
+template <typename Index>
+class extent<Index, dynamic_extent>
 {
+public:
+    using position_type = typename index_traits<Index>::position_type;
+    using lap_type = typename index_traits<Index>::lap_type;
+
 private:
+    static const unsigned kIndexBits = index_traits<Index>::index_bits;
+    static const unsigned kPositionBits = sizeof(position_type) * 8;
+
+    Index cap_;
+
+public:
+    explicit extent(Index cap) noexcept : cap_{ cap } { }
+
+    Index capacity() const noexcept { return cap_; }
+
+    static constexpr position_type spare_bit() noexcept
+    {
+        return (position_type)(position_type{ 1 } << (kPositionBits - 1));
+    }
+
+    static constexpr lap_type lap_mask() noexcept
+    {
+        return detail::lap_mask<lap_type>(kPositionBits - 1 - kIndexBits);
+    }
+
+    static constexpr position_type round_mask() noexcept
+    {
+        return (position_type)((position_type)~spare_bit() >> kIndexBits);
+    }
+
+    // low index_bits bits represent position in the buffer,
+    // the bits above them up to the spare bit represent the current round over the ring buffer
+    Index index(position_type x) const noexcept
+    {
+        return (Index)(x & ((position_type{ 1 } << kIndexBits) - 1));
+    }
+
+    position_type round(position_type x) const noexcept
+    {
+        return (position_type)(x & ~spare_bit()) >> kIndexBits;
+    }
+
+    position_type next(position_type x) const noexcept
+    {
+        if (index(x) + 1 < cap_) {
+            return (position_type)(x + 1);
+        }
+        return (position_type)(((round(x) + 1) << kIndexBits) & ~spare_bit());
+    }
+
+    // position n elements after x, n <= capacity()
+    position_type advance(position_type x, Index n) const noexcept
+    {
+        if (index(x) + n < cap_) {
+            return (position_type)(x + n);
+        }
+        return (position_type)((((round(x) + 1) << kIndexBits) & ~spare_bit())
+                               | (position_type)(index(x) + n - cap_));
+    }
+
+    position_type distance(position_type send, position_type recv) const noexcept
+    {
+        auto rounds{ (position_type)((round(send) - round(recv)) & round_mask()) };
+        return (position_type)(rounds * cap_ + index(send) - index(recv));
+    }
+};
+
+// Element counter of a counted policy, on its own cache line as both sides write it.
+struct alignas(CACHE_PADDED) size_counter
+{
+    std::atomic<std::size_t> n{ 0 };
+
+    void add(std::size_t k) noexcept { n.fetch_add(k, std::memory_order_relaxed); }
+
+    void sub(std::size_t k) noexcept { n.fetch_sub(k, std::memory_order_relaxed); }
+
+    std::size_t load() const noexcept { return n.load(std::memory_order_relaxed); }
+};
+
+// Stand-in for the other policies.
+struct no_size_counter
+{
+    void add(std::size_t) noexcept { }
+
+    void sub(std::size_t) noexcept { }
+
+    std::size_t load() const noexcept { return 0; }
+};
+
+// n U, from Alloc for HEAP or on mapped pages for any other backing or a node.
+// U is default-initialized, so the pages of a trivial U are only touched when the elements
+// are first used, value_init value-initializes it instead, e.g. for the laps.
+template <typename U, typename Alloc>
+class ring_array
+{
+    static_assert(std::is_trivially_destructible<U>::value, "U have to be trivially destructible");
+
+    using alloc_type = typename std::allocator_traits<Alloc>::template rebind_alloc<U>;
+    using alloc_traits = std::allocator_traits<alloc_type>;
+
+    alloc_type alloc_;
+    page_buffer pages_;
+    std::size_t n_;
+    U *data_;
+
+public:
+    ring_array(std::size_t n, bool value_init, Backing backing, int node, const Alloc &alloc)
+        : alloc_{ alloc }, pages_{ n * sizeof(U), backing, node }, n_{ n },
+          data_{ static_cast<U *>(pages_.data()) }
+    {
+        if (data_ == nullptr) {
+            data_ = alloc_traits::allocate(alloc_, n);
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            if (value_init) {
+                ::new (static_cast<void *>(data_ + i)) U();
+            } else {
+                ::new (static_cast<void *>(data_ + i)) U;
+            }
+        }
+    }
+
+    ~ring_array()
+    {
+        if (pages_.data() == nullptr) {
+            alloc_traits::deallocate(alloc_, data_, n_);
+        }
+    }
+
+    U &operator[](std::size_t i) noexcept { return data_[i]; }
+
+    const U &operator[](std::size_t i) const noexcept { return data_[i]; }
+
+    U *get() const noexcept { return data_; }
+
+    Backing backing() const noexcept { return pages_.backing(); }
+};
+
+// Laps and values of the elements of a ring buffer, laid out by Layout.
+// The lap arrays are not allocated without laps, the spsc_cached policy does not use them.
+template <typename T, typename Lap, typename Layout, typename Alloc>
+class elements;
+
+template <typename T, typename Lap, typename Alloc>
+class elements<T, Lap, soa, Alloc>
+{
+    // User data,
+    // constructed by push and destroyed by pop
+    struct slot
+    {
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    ring_array<slot, Alloc> values_;
+
+    // current lap of each element,
+    // the element is ready for writing on laps 0, 2, 4, ...
+    // for reading on laps 1, 3, 5, ...
+    ring_array<std::atomic<Lap>, Alloc> laps_;
+
+public:
+    // the values and the laps are dense arrays
+    static const bool dense = true;
+
+    // value(i + capacity) is value(i)
+    static const bool mirrored = false;
+
+    elements(std::size_t cap, bool laps, Backing backing, int node, const Alloc &alloc)
+        : values_{ cap, false, backing, node, alloc },
+          laps_{ laps ? cap : 0, true, backing, node, alloc }
+    {
+    }
+
+    Backing backing() const noexcept { return values_.backing(); }
+
+    T *value(std::size_t i) noexcept { return reinterpret_cast<T *>(values_[i].storage); }
+
+    const T *value(std::size_t i) const noexcept
+    {
+        return reinterpret_cast<const T *>(values_[i].storage);
+    }
+
+    std::atomic<Lap> &lap(std::size_t i) noexcept { return laps_[i]; }
+
+    const std::atomic<Lap> *laps() const noexcept { return laps_.get(); }
+};
+
+template <typename T, typename Lap, typename Alloc>
+class elements<T, Lap, aos, Alloc>
+{
     struct elem
     {
         // current lap,
         // the element is ready for writing on laps 0, 2, 4, ...
         // for reading on laps 1, 3, 5, ...
-        std::atomic<uint16_t> lap{ 0 };
+        std::atomic<Lap> lap{ 0 };
+
+        // User data,
+        // constructed by push and destroyed by pop
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    ring_array<elem, Alloc> buf_;
+
+public:
+    static const bool dense = false;
+    static const bool mirrored = false;
+
+    elements(std::size_t cap, bool, Backing backing, int node, const Alloc &alloc)
+        : buf_{ cap, false, backing, node, alloc }
+    {
+    }
+
+    Backing backing() const noexcept { return buf_.backing(); }
 
-        // User data
-        T value;
+    T *value(std::size_t i) noexcept { return reinterpret_cast<T *>(buf_[i].storage); }
 
-        elem() noexcept = default;
+    const T *value(std::size_t i) const noexcept
+    {
+        return reinterpret_cast<const T *>(buf_[i].storage);
+    }
+
+    std::atomic<Lap> &lap(std::size_t i) noexcept { return buf_[i].lap; }
+};
+
+#if defined(__linux__)
+template <typename T, typename Lap, typename Alloc>
+class elements<T, Lap, mirror, Alloc>
+{
+    mirror_buffer values_;
+
+    // current lap of each element, see soa
+    ring_array<std::atomic<Lap>, Alloc> laps_;
+
+public:
+    static const bool dense = true;
+    static const bool mirrored = true;
+
+    // Throw std::invalid_argument when the values do not fill whole pages,
+    // a failed mapping is reported like a failed allocation.
+    // The values are always on base pages of the memfd, backing only applies to the laps.
+    elements(std::size_t cap, bool laps, Backing backing, int node, const Alloc &alloc)
+        : values_{ cap * sizeof(T) }, laps_{ laps ? cap : 0, true, backing, node, alloc }
+    {
+        if (cap * sizeof(T) % mirror_buffer::page_size() != 0) {
+            throw std::invalid_argument{ "mirror values have to fill whole pages" };
+        }
+        if (values_.data() == nullptr) {
+            throw std::bad_alloc{};
+        }
+        if (node != kAnyNode) {
+            numa_prefer(values_.data(), values_.size(), node);
+        }
+    }
+
+    Backing backing() const noexcept { return Backing::PAGES; }
+
+    T *value(std::size_t i) noexcept { return reinterpret_cast<T *>(values_.data()) + i; }
+
+    const T *value(std::size_t i) const noexcept
+    {
+        return reinterpret_cast<const T *>(values_.data()) + i;
+    }
+
+    std::atomic<Lap> &lap(std::size_t i) noexcept { return laps_[i]; }
+
+    const std::atomic<Lap> *laps() const noexcept { return laps_.get(); }
+};
+#endif
+} // namespace detail
+
+// Bounded queue of T.
+// N fixes the capacity at compile time and has to be a power of two,
+// the default dynamic_extent takes the capacity in the constructor instead.
+// Index is the unsigned type of the capacity and of the element laps (uint8_t .. uint64_t),
+// it bounds the capacity to 255, 65535, 2^32 - 1 and 2^40 - 1 elements.
+// Policy is one of spsc, spsc_cached, mpsc, spmc and mpmc, all of them share the element layout,
+// or counted<> of one of them.
+// Wait is the wait strategy of the blocking calls, see wait_strategy.hpp.
+// Layout is soa, aos or mirror, see detail::elements.
+// Allocator allocates the ring buffer on the HEAP backing.
+template <typename T,
+          std::size_t N = dynamic_extent,
+          typename Index = uint16_t,
+          typename Policy = spsc,
+          typename Wait = busy_spin,
+          typename Layout = soa,
+          typename Allocator = std::allocator<T>>
+class queue
+{
+private:
+    using extent_type = detail::extent<Index, N>;
+    using position_type = typename extent_type::position_type;
+    using lap_type = typename extent_type::lap_type;
+    using multi_producer = std::integral_constant<bool, Policy::multi_producer>;
+    using multi_consumer = std::integral_constant<bool, Policy::multi_consumer>;
+    using cached_index = std::integral_constant<bool, Policy::cached_index>;
+    using counter_type = typename std::
+        conditional<Policy::size_counter, detail::size_counter, detail::no_size_counter>::type;
+    using elements_type = detail::elements<T, lap_type, Layout, Allocator>;
+
+    // How a side claims elements, a tag of the select functions:
+    // std::true_type for several threads, std::false_type for one thread
+    // and cached for one thread with a copy of the opposite position.
+    struct cached
+    {
     };
+    using producer_tag =
+        typename std::conditional<cached_index::value, cached, multi_producer>::type;
+    using consumer_tag =
+        typename std::conditional<cached_index::value, cached, multi_consumer>::type;
 
+    // The fields are grouped by the thread that writes them,
+    // each group starts on its own cache line.
+    // send and receive positions are laid out by detail::extent,
+    // both start on round 0 and the consumer reads on the lap after the producer
+
+    // Read-only after construction.
     // queue capacity
-    uint16_t cap_;
+    extent_type extent_;
 
     // ring buffer
-    std::unique_ptr<elem[]> buf_{};
+    elements_type buf_;
+
+    // Producer-owned.
+    alignas(CACHE_PADDED) std::atomic<position_type> sendX_{ 0 };
+    // producer's copy of recvX_, refreshed only when the ring looks full (spsc_cached)
+    position_type recv_cache_{ 0 };
+    // element handed out by reserve() and not yet committed
+    T *reserved_{ nullptr };
+    Index reserved_index_{ 0 };
+    lap_type reserved_lap_{ 0 };
+    // elements pushed after the reserved one, published with it by commit() (spsc_cached)
+    Index held_{ 0 };
 
-    // calculate length.
-    std::atomic<uint32_t> size_{ 0 };
+    // Consumer-owned.
+    alignas(CACHE_PADDED) std::atomic<position_type> recvX_{ 0 };
+    // consumer's copy of sendX_, refreshed only when the ring looks empty (spsc_cached)
+    position_type send_cache_{ 0 };
 
-    // send and receive positions,
-    // low 16 bits represent position in the buffer,
-    // high 16 bits represent the current “lap” over the ring buffer
-    alignas(CACHE_PADDED) std::atomic<uint32_t> sendX_{ 0 };
-    alignas(CACHE_PADDED) uint32_t recvX_{ static_cast<uint32_t>(1 << 16) };
+    // Written by both sides, with a counted policy.
+    counter_type size_;
 
-    std::tuple<elem *, uint16_t, State> select_4_read()
+    // Written by close(), read by both sides.
+    alignas(CACHE_PADDED) std::atomic<bool> closed_{ false };
+
+    // Written by waiting consumers, read by the producer's notify.
+    alignas(CACHE_PADDED) Wait not_empty_;
+
+    // Written by waiting producers, read by the consumer's notify.
+    alignas(CACHE_PADDED) Wait not_full_;
+
+    // lap of the element at a send position
+    lap_type send_lap(position_type x) const noexcept
+    {
+        return (lap_type)((extent_.round(x) << 1) & extent_type::lap_mask());
+    }
+
+    // lap of the element at a receive position
+    lap_type recv_lap(position_type x) const noexcept
     {
-        auto pos{ (uint16_t)recvX_ };
-        auto lap{ (uint16_t)(recvX_ >> 16) };
-        auto elem = &buf_.get()[pos];
-        auto elem_lap{ elem->lap.load(std::memory_order_acquire) };
+        return (lap_type)((extent_.round(x) << 1 | 1) & extent_type::lap_mask());
+    }
+
+    static lap_type next_lap(lap_type lap) noexcept
+    {
+        return (lap_type)((lap + 1) & extent_type::lap_mask());
+    }
+
+    // whether elem_lap is behind lap, the laps wrap so they are compared
+    // by their difference within half of the lap range
+    static bool lap_behind(lap_type elem_lap, lap_type lap) noexcept
+    {
+        auto d{ (lap_type)((lap - elem_lap) & extent_type::lap_mask()) };
+        return d != 0 && d <= (extent_type::lap_mask() >> 1);
+    }
+
+    // first free send position of a single producer,
+    // past the element handed out by reserve() and the ones held behind it
+    position_type send_head() const noexcept
+    {
+        auto x{ sendX_.load(std::memory_order_relaxed) };
+        return reserved_ == nullptr ? x : extent_.advance(x, (Index)(held_ + 1));
+    }
+
+    std::tuple<Index, lap_type, State> select_4_read()
+    {
+        return this->select_4_read(consumer_tag{});
+    }
+
+    // single consumer with a copy of sendX_, the position is advanced by commit_read
+    std::tuple<Index, lap_type, State> select_4_read(cached)
+    {
+        auto x{ recvX_.load(std::memory_order_relaxed) };
+        if (extent_.distance(send_cache_, x) == 0) {
+            send_cache_ = sendX_.load(std::memory_order_acquire);
+            if (extent_.distance(send_cache_, x) == 0) {
+                return std::make_tuple(0, 0, State::EMPTY);
+            }
+        }
+        return std::make_tuple(extent_.index(x), 0, State::SUCCESS);
+    }
+
+    // single consumer, the position is advanced by commit_read
+    std::tuple<Index, lap_type, State> select_4_read(std::false_type)
+    {
+        auto x{ recvX_.load(std::memory_order_relaxed) };
+        auto lap{ recv_lap(x) };
+        auto i{ extent_.index(x) };
+        auto elem_lap{ buf_.lap(i).load(std::memory_order_acquire) };
 
         if (lap == elem_lap) {
-            // The element is ready for writing on this lap.
-            // Try to claim the right to write to this element.
-            if (pos + 1 < cap_) {
-                recvX_ = recvX_ + 1;
+            // The element is ready for reading on this lap.
+            return std::make_tuple(i, elem_lap, State::SUCCESS);
+        }
+        // The element is not yet written on this lap,
+        // the chan is empty.
+        return std::make_tuple(0, 0, State::EMPTY);
+    }
+
+    // multiple consumers claim the element with a CAS on the position
+    std::tuple<Index, lap_type, State> select_4_read(std::true_type)
+    {
+        auto x{ recvX_.load(std::memory_order_relaxed) };
+        while (true) {
+            auto lap{ recv_lap(x) };
+            auto i{ extent_.index(x) };
+            auto elem_lap{ buf_.lap(i).load(std::memory_order_acquire) };
+
+            if (lap == elem_lap) {
+                // The element is ready for reading on this lap.
+                // Try to claim the right to read this element.
+                auto new_x{ extent_.next(x) };
+                auto m1{ std::memory_order_acquire };
+                auto m2{ std::memory_order_relaxed };
+                if (recvX_.compare_exchange_weak(x, new_x, m1, m2)) {
+                    // We own the element.
+                    return std::make_tuple(i, elem_lap, State::SUCCESS);
+                }
+            } else if (lap_behind(elem_lap, lap)) {
+                // The element is not yet written on this lap,
+                // or a consumer of an earlier lap has not released it yet,
+                // the chan is empty.
+                return std::make_tuple(0, 0, State::EMPTY);
             } else {
-                recvX_ = (uint32_t)(lap + 2) << 16;
+                // The element has already been read on this lap,
+                // this means that `recv_x` has been changed as well, retry.
+                x = recvX_.load(std::memory_order_relaxed);
             }
-            return std::make_tuple(elem, elem_lap, State::SUCCESS);
-        } else if ((int16_t)(lap - elem_lap) > 0) {
-            // The element is not yet read on the previous lap,
-            // the chan is empty.
-            if (lap > elem->lap.load(std::memory_order_acquire)) {
-                return std::make_tuple(nullptr, 0, State::EMPTY);
+        }
+    }
+
+    std::tuple<Index, lap_type, State> select_4_write()
+    {
+        return this->select_4_write(producer_tag{});
+    }
+
+    // single producer with a copy of recvX_, the position is advanced by commit_write
+    std::tuple<Index, lap_type, State> select_4_write(cached)
+    {
+        auto x{ this->send_head() };
+        if (closed_.load(std::memory_order_relaxed)) {
+            return std::make_tuple(0, 0, State::CLOSED);
+        }
+        if (extent_.distance(x, recv_cache_) >= extent_.capacity()) {
+            recv_cache_ = recvX_.load(std::memory_order_acquire);
+            if (extent_.distance(x, recv_cache_) >= extent_.capacity()) {
+                return std::make_tuple(0, 0, State::FULL);
             }
-            // The element has already been written on this lap,
-            // this means that `send_x` has been changed as well,
-            // retry.
         }
-        // The case lap < elem_lap occurs if and only if environment have more than 2 threads
-        // and more than 2 disputing threads are same read or write operation.
-        return std::make_tuple(nullptr, 0, State::EMPTY); // Fix lint.
+        return std::make_tuple(extent_.index(x), 0, State::SUCCESS);
+    }
+
+    // single producer, the position is advanced by commit_write
+    std::tuple<Index, lap_type, State> select_4_write(std::false_type)
+    {
+        auto x{ this->send_head() };
+        if (closed_.load(std::memory_order_relaxed)) {
+            return std::make_tuple(0, 0, State::CLOSED);
+        }
+
+        auto lap{ send_lap(x) };
+        auto i{ extent_.index(x) };
+        auto elem_lap{ buf_.lap(i).load(std::memory_order_acquire) };
+
+        if (lap == elem_lap) {
+            // The element is ready for writing on this lap.
+            return std::make_tuple(i, elem_lap, State::SUCCESS);
+        }
+        // The element is not yet read on the previous lap,
+        // the chan is full.
+        return std::make_tuple(0, 0, State::FULL);
     }
 
-    std::tuple<elem *, uint16_t, State> select_4_write()
+    // multiple producers claim the element with a CAS on the position
+    std::tuple<Index, lap_type, State> select_4_write(std::true_type)
     {
-        uint16_t pos;
-        uint16_t lap;
-        uint16_t elem_lap;
-        uint32_t x;
-        elem *elem;
+        lap_type lap;
+        lap_type elem_lap;
+        position_type x;
+        Index i;
 
         x = sendX_.load(std::memory_order_relaxed);
         while (true) {
-            lap = (x >> 16);
-            if (lap >= kMask16) {
-                return std::make_tuple(nullptr, 0, State::CLOSED);
+            if (closed_.load(std::memory_order_relaxed)) {
+                return std::make_tuple(0, 0, State::CLOSED);
             }
 
-            pos = (uint16_t)x;
-            elem = &buf_.get()[pos];
-            elem_lap = elem->lap.load(std::memory_order_acquire);
+            lap = send_lap(x);
+            i = extent_.index(x);
+            elem_lap = buf_.lap(i).load(std::memory_order_acquire);
 
             if (lap == elem_lap) {
                 // The element is ready for writing on this lap.
                 // Try to claim the right to write to this element.
-                uint32_t new_x;
-                if (pos + 1 < cap_) {
-                    new_x = x + 1;
-                } else {
-                    new_x = (uint32_t)(lap + 2) << 16;
-                }
-
+                auto new_x{ extent_.next(x) };
                 auto m1{ std::memory_order_acquire };
                 auto m2{ std::memory_order_relaxed };
                 if (sendX_.compare_exchange_weak(x, new_x, m1, m2)) {
                     // We own the element.
-                    return std::make_tuple(elem, elem_lap, State::SUCCESS);
+                    return std::make_tuple(i, elem_lap, State::SUCCESS);
                 }
-            } else if ((int16_t)(lap - elem_lap) > 0) {
-                // The element is not yet write on the previous lap,
+            } else if (lap_behind(elem_lap, lap)) {
+                // The element is not yet read on the previous lap,
+                // or a producer of an earlier lap has not written it yet,
                 // the chan is full.
-                if (lap > elem->lap.load(std::memory_order_acquire)) {
-                    return std::make_tuple(nullptr, 0, State::FULL);
+                return std::make_tuple(0, 0, State::FULL);
+            } else {
+                // The case lap < elem_lap occurs if and only if environment have more than 2
+                // threads and more than 2 disputing threads are same read or write operation.
+                // The element has already been written on this lap,
+                // this means that `send_x` has been changed as well, retry.
+                x = sendX_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // publish the element claimed by select_4_write
+    void commit_write(Index i, lap_type elem_lap)
+    {
+        if (cached_index::value) {
+            // The consumer finds the elements by sendX_,
+            // the ones behind a reserved element wait for commit().
+            if (reserved_ != nullptr) {
+                held_++;
+            } else {
+                sendX_.store(extent_.next(sendX_.load(std::memory_order_relaxed)),
+                             std::memory_order_release);
+            }
+        } else {
+            if (!multi_producer::value) {
+                // The consumer never reads sendX_ to find elements,
+                // the store only has to come before the lap for len().
+                sendX_.store(extent_.next(sendX_.load(std::memory_order_relaxed)),
+                             std::memory_order_relaxed);
+            }
+            buf_.lap(i).store(next_lap(elem_lap), std::memory_order_release);
+        }
+        size_.add(1);
+        not_empty_.notify();
+    }
+
+    // hand the element claimed by select_4_read back to the producer
+    void commit_read(Index i, lap_type elem_lap)
+    {
+        if (cached_index::value) {
+            // The producer finds the free elements by recvX_.
+            recvX_.store(extent_.next(recvX_.load(std::memory_order_relaxed)),
+                         std::memory_order_release);
+        } else {
+            buf_.lap(i).store(next_lap(elem_lap), std::memory_order_release);
+            if (!multi_consumer::value) {
+                recvX_.store(extent_.next(recvX_.load(std::memory_order_relaxed)),
+                             std::memory_order_relaxed);
+            }
+        }
+        size_.sub(1);
+        not_full_.notify();
+    }
+
+    // claim up to max ready elements from the receive position,
+    // return the first position and the number of claimed elements
+    std::tuple<position_type, Index, State> select_n_4_read(Index max)
+    {
+        return this->select_n_4_read(max, consumer_tag{});
+    }
+
+    // number of elements ready for reading from x on, up to max
+    Index ready_4_read(position_type x, Index max)
+    {
+        return this->ready_4_read(x, max, std::integral_constant<bool, elements_type::dense>{});
+    }
+
+    Index ready_4_read(position_type x, Index max, std::false_type)
+    {
+        Index n{ 0 };
+        for (; n < max; x = extent_.next(x), n++) {
+            if (buf_.lap(extent_.index(x)).load(std::memory_order_acquire) != recv_lap(x)) {
+                break;
+            }
+        }
+        return n;
+    }
+
+    // The laps of a round are all equal, scan them a vector at a time
+    // up to the end of the ring buffer, then go on with the next round.
+    Index ready_4_read(position_type x, Index max, std::true_type)
+    {
+        Index n{ 0 };
+        while (n < max) {
+            auto i{ extent_.index(x) };
+            Index run = extent_.capacity() - i;
+            run = max - n < run ? max - n : run;
+            auto ready{ (Index)detail::count_laps(buf_.laps() + i, recv_lap(x), run) };
+            n += ready;
+            if (ready < run) {
+                break;
+            }
+            x = extent_.advance(x, run);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return n;
+    }
+
+    std::tuple<position_type, Index, State> select_n_4_read(Index max, cached)
+    {
+        auto x{ recvX_.load(std::memory_order_relaxed) };
+        auto ready{ extent_.distance(send_cache_, x) };
+        if (ready < max) {
+            send_cache_ = sendX_.load(std::memory_order_acquire);
+            ready = extent_.distance(send_cache_, x);
+            if (ready == 0) {
+                return std::make_tuple(x, 0, State::EMPTY);
+            }
+        }
+        return std::make_tuple(x, ready < max ? ready : max, State::SUCCESS);
+    }
+
+    std::tuple<position_type, Index, State> select_n_4_read(Index max, std::false_type)
+    {
+        auto x{ recvX_.load(std::memory_order_relaxed) };
+        auto n{ this->ready_4_read(x, max) };
+        return std::make_tuple(x, n, n > 0 ? State::SUCCESS : State::EMPTY);
+    }
+
+    std::tuple<position_type, Index, State> select_n_4_read(Index max, std::true_type)
+    {
+        auto x{ recvX_.load(std::memory_order_relaxed) };
+        while (true) {
+            auto n{ this->ready_4_read(x, max) };
+
+            if (n > 0) {
+                // Try to claim the right to read these elements.
+                auto y{ extent_.advance(x, n) };
+                auto m1{ std::memory_order_acquire };
+                auto m2{ std::memory_order_relaxed };
+                if (recvX_.compare_exchange_weak(x, y, m1, m2)) {
+                    // We own the elements.
+                    return std::make_tuple(x, n, State::SUCCESS);
                 }
-                // The element has already been read on this lap,
-                // this means that `recv_x` has been changed as well,
-                // retry.
+            } else {
+                auto lap{ recv_lap(x) };
+                auto elem_lap{ buf_.lap(extent_.index(x)).load(std::memory_order_acquire) };
+                if (lap_behind(elem_lap, lap)) {
+                    // The element is not yet written on this lap,
+                    // the chan is empty.
+                    return std::make_tuple(x, 0, State::EMPTY);
+                }
+                // The element has already been read on this lap, retry.
+                x = recvX_.load(std::memory_order_relaxed);
             }
-            // The case lap < elem_lap occurs if and only if environment have more than 2 threads
-            // and more than 2 disputing threads are same read or write operation.
         }
     }
 
+    // claim up to max free elements from the send position,
+    // return the first position and the number of claimed elements
+    std::tuple<position_type, Index, State> select_n_4_write(Index max)
+    {
+        return this->select_n_4_write(max, producer_tag{});
+    }
+
+    std::tuple<position_type, Index, State> select_n_4_write(Index max, cached)
+    {
+        auto x{ this->send_head() };
+        if (closed_.load(std::memory_order_relaxed)) {
+            return std::make_tuple(x, 0, State::CLOSED);
+        }
+        auto room{ extent_.capacity() - extent_.distance(x, recv_cache_) };
+        if (room < max) {
+            recv_cache_ = recvX_.load(std::memory_order_acquire);
+            room = extent_.capacity() - extent_.distance(x, recv_cache_);
+            if (room == 0) {
+                return std::make_tuple(x, 0, State::FULL);
+            }
+        }
+        return std::make_tuple(x, room < max ? room : max, State::SUCCESS);
+    }
+
+    std::tuple<position_type, Index, State> select_n_4_write(Index max, std::false_type)
+    {
+        auto x{ this->send_head() };
+        if (closed_.load(std::memory_order_relaxed)) {
+            return std::make_tuple(x, 0, State::CLOSED);
+        }
+
+        Index n{ 0 };
+        for (auto y = x; n < max; y = extent_.next(y), n++) {
+            if (buf_.lap(extent_.index(y)).load(std::memory_order_acquire) != send_lap(y)) {
+                break;
+            }
+        }
+        return std::make_tuple(x, n, n > 0 ? State::SUCCESS : State::FULL);
+    }
+
+    std::tuple<position_type, Index, State> select_n_4_write(Index max, std::true_type)
+    {
+        auto x{ sendX_.load(std::memory_order_relaxed) };
+        while (true) {
+            if (closed_.load(std::memory_order_relaxed)) {
+                return std::make_tuple(x, 0, State::CLOSED);
+            }
+
+            Index n{ 0 };
+            auto y{ x };
+            for (; n < max; y = extent_.next(y), n++) {
+                auto &elem_lap = buf_.lap(extent_.index(y));
+                if (elem_lap.load(std::memory_order_acquire) != send_lap(y)) {
+                    break;
+                }
+            }
+
+            if (n > 0) {
+                // Try to claim the right to write to these elements.
+                auto m1{ std::memory_order_acquire };
+                auto m2{ std::memory_order_relaxed };
+                if (sendX_.compare_exchange_weak(x, y, m1, m2)) {
+                    // We own the elements.
+                    return std::make_tuple(x, n, State::SUCCESS);
+                }
+            } else {
+                auto lap{ send_lap(x) };
+                auto elem_lap{ buf_.lap(extent_.index(x)).load(std::memory_order_acquire) };
+                if (lap_behind(elem_lap, lap)) {
+                    // The element is not yet read on the previous lap,
+                    // the chan is full.
+                    return std::make_tuple(x, 0, State::FULL);
+                }
+                // The element has already been written on this lap, retry.
+                x = sendX_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // publish n elements claimed by select_n_4_write,
+    // the release fence orders all values before the relaxed lap stores
+    void commit_n_write(position_type x, Index n)
+    {
+        if (cached_index::value) {
+            if (reserved_ != nullptr) {
+                held_ = (Index)(held_ + n);
+            } else {
+                sendX_.store(extent_.advance(x, n), std::memory_order_release);
+            }
+        } else {
+            if (!multi_producer::value) {
+                // x is after the reserved element, if any.
+                auto send{ sendX_.load(std::memory_order_relaxed) };
+                sendX_.store(extent_.advance(send, n), std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            for (Index i = 0; i < n; i++, x = extent_.next(x)) {
+                buf_.lap(extent_.index(x)).store(next_lap(send_lap(x)), std::memory_order_relaxed);
+            }
+        }
+        size_.add(n);
+        not_empty_.notify();
+    }
+
+    // hand n elements claimed by select_n_4_read back to the producer,
+    // the release fence orders all reads before the relaxed lap stores
+    void commit_n_read(position_type x, Index n)
+    {
+        if (cached_index::value) {
+            recvX_.store(extent_.advance(x, n), std::memory_order_release);
+        } else {
+            std::atomic_thread_fence(std::memory_order_release);
+            auto y{ x };
+            for (Index i = 0; i < n; i++, y = extent_.next(y)) {
+                buf_.lap(extent_.index(y)).store(next_lap(recv_lap(y)), std::memory_order_relaxed);
+            }
+            if (!multi_consumer::value) {
+                recvX_.store(extent_.advance(x, n), std::memory_order_relaxed);
+            }
+        }
+        size_.sub(n);
+        not_full_.notify();
+    }
+
+    bool closed() const noexcept { return closed_.load(std::memory_order_acquire); }
+
+    // select_4_read for pops, EMPTY becomes CLOSED once the queue is closed and drained.
+    // The flag is only loaded after a failed read, which is retried once
+    // to see the elements pushed before close().
+    std::tuple<Index, lap_type, State> select_4_pop()
+    {
+        auto selected = this->select_4_read();
+        if (std::get<2>(selected) == State::EMPTY && this->closed()) {
+            selected = this->select_4_read();
+            if (std::get<2>(selected) == State::EMPTY) {
+                std::get<2>(selected) = State::CLOSED;
+            }
+        }
+        return selected;
+    }
+
+    // The constructors throw when the ring buffer of the mirror layout cannot be mapped,
+    // a user allocator fails, e.g. an exhausted std::pmr arena, or the wait strategy cannot
+    // be set up, e.g. the eventfd of eventfd_notify.
+    // std::allocator keeps the noexcept of the original queue.
+    static const bool kNothrowConstruct =
+        !elements_type::mirrored && std::is_same<Allocator, std::allocator<T>>::value &&
+        std::is_nothrow_default_constructible<Wait>::value;
+
+    // Runs of T are copied with memcpy between the ring buffer and a pointer to T.
+    template <typename Ptr>
+    using bulk_copy = std::integral_constant<
+        bool,
+        elements_type::dense && std::is_trivially_copyable<T>::value
+            && std::is_pointer<Ptr>::value
+            && std::is_same<T, typename std::remove_cv<
+                                   typename std::remove_pointer<Ptr>::type>::type>::value>;
+
+    // construct the n elements claimed from x out of first .. first + n
+    template <typename ForwardIt>
+    void write_n(position_type x, Index n, ForwardIt first, std::false_type)
+    {
+        for (Index i = 0; i < n; i++, ++first, x = extent_.next(x)) {
+            ::new (static_cast<void *>(buf_.value(extent_.index(x)))) T(*first);
+        }
+    }
+
+    // the run is split at the end of the ring buffer into at most two copies,
+    // a mirrored ring buffer needs one
+    template <typename Ptr>
+    void write_n(position_type x, Index n, Ptr first, std::true_type)
+    {
+        auto i{ extent_.index(x) };
+        if (elements_type::mirrored) {
+            std::memcpy(static_cast<void *>(buf_.value(i)), first, n * sizeof(T));
+            return;
+        }
+        Index run = extent_.capacity() - i;
+        run = n < run ? n : run;
+        std::memcpy(static_cast<void *>(buf_.value(i)), first, run * sizeof(T));
+        std::memcpy(static_cast<void *>(buf_.value(0)), first + run, (n - run) * sizeof(T));
+    }
+
+    // move n claimed elements from x on into out and destroy them
+    template <typename OutputIt>
+    void read_n(position_type x, Index n, OutputIt out, std::false_type)
+    {
+        for (Index i = 0; i < n; i++, ++out, x = extent_.next(x)) {
+            auto value = buf_.value(extent_.index(x));
+            *out = std::move(*value);
+            value->~T();
+        }
+    }
+
+    template <typename Ptr>
+    void read_n(position_type x, Index n, Ptr out, std::true_type)
+    {
+        auto i{ extent_.index(x) };
+        if (elements_type::mirrored) {
+            std::memcpy(out, buf_.value(i), n * sizeof(T));
+            return;
+        }
+        Index run = extent_.capacity() - i;
+        run = n < run ? n : run;
+        std::memcpy(out, buf_.value(i), run * sizeof(T));
+        std::memcpy(out + run, buf_.value(0), (n - run) * sizeof(T));
+    }
+
 public:
-    explicit queue(uint16_t cap) noexcept : cap_{ cap }
-    {
-        static_assert(std::is_copy_assignable<T>::value || std::is_move_assignable<T>::value,
-                      "T have to copy or move assigment for push");
-        static_assert(std::is_default_constructible<T>::value
-                              && std::is_move_constructible<T>::value,
-                      "T have to default and move constructor for pop");
-        // For buf
+    // Read-only view of elements at the front of the queue, see try_peek_n().
+    class view
+    {
+        friend class queue;
+
+        const queue *q_{ nullptr };
+        position_type x_{ 0 };
+        Index n_{ 0 };
+
+        view(const queue *q, position_type x, Index n) noexcept : q_{ q }, x_{ x }, n_{ n } { }
+
+    public:
+        view() noexcept = default;
+
+        std::size_t size() const noexcept { return n_; }
+
+        bool empty() const noexcept { return n_ == 0; }
+
+        const T &operator[](std::size_t i) const noexcept
+        {
+            assert(i < n_);
+            auto x{ q_->extent_.advance(x_, (Index)i) };
+            return *q_->buf_.value(q_->extent_.index(x));
+        }
+
+        // The elements of the view as one array, with the mirror layout.
+        const T *data() const noexcept
+        {
+            static_assert(elements_type::mirrored, "view::data have to get the mirror layout");
+            return q_->buf_.value(q_->extent_.index(x_));
+        }
+    };
+
+    // For queue<T, N>, the capacity is N.
+    queue() noexcept(kNothrowConstruct) : queue(Backing::HEAP) { }
+
+    // The ring buffer is allocated with the requested backing or the closest one obtained,
+    // see backing(). A node places it on that NUMA node, or on the node of the calling thread
+    // for kLocalNode, see node(). The positions are part of the queue object, construct it
+    // in memory of the consumer's node to place them as well.
+    explicit queue(Backing backing,
+                   int node = kAnyNode,
+                   const Allocator &alloc = Allocator()) noexcept(kNothrowConstruct)
+        : buf_{ N, !cached_index::value, backing, node, alloc }
+    {
+        static_assert(N != dynamic_extent, "queue<T> have to get its capacity in the constructor");
+        // 4 KB is the smallest page size, larger pages are checked when the values are mapped.
+        static_assert(!elements_type::mirrored || N * sizeof(T) % 4096 == 0,
+                      "N * sizeof(T) have to fill whole pages with the mirror layout");
+        static_assert(std::is_move_constructible<T>::value, "T have to move constructor for pop");
+    }
+
+    explicit queue(const Allocator &alloc) noexcept(kNothrowConstruct)
+        : queue(Backing::HEAP, kAnyNode, alloc)
+    {
+    }
+
+    explicit queue(Index cap,
+                   Backing backing = Backing::HEAP,
+                   int node = kAnyNode,
+                   const Allocator &alloc = Allocator()) noexcept(kNothrowConstruct)
+        : extent_{ cap }, buf_{ cap, !cached_index::value, backing, node, alloc }
+    {
+        static_assert(N == dynamic_extent, "queue<T, N> have a fixed capacity");
+        static_assert(std::is_move_constructible<T>::value, "T have to move constructor for pop");
         assert(cap > 0);
-        buf_.reset(new elem[cap]);
+    }
+
+    queue(Index cap, const Allocator &alloc) noexcept(kNothrowConstruct)
+        : queue(cap, Backing::HEAP, kAnyNode, alloc)
+    {
+    }
+
+    ~queue()
+    {
+        if (std::is_trivially_destructible<T>::value) {
+            return;
+        }
+        if (reserved_ != nullptr) {
+            // The reserved element is constructed, drain it with the others.
+            this->commit();
+        }
+
+        position_type x;
+        Index n;
+        std::tie(x, n, std::ignore) = this->select_n_4_read(extent_.capacity());
+        for (Index i = 0; i < n; i++, x = extent_.next(x)) {
+            buf_.value(extent_.index(x))->~T();
+        }
     }
 
     State try_push(const T &val)
     {
-        elem *elem;
-        uint16_t elem_lap;
+        Index i;
+        lap_type elem_lap;
         State state;
 
-        std::tie(elem, elem_lap, state) = this->select_4_write();
+        std::tie(i, elem_lap, state) = this->select_4_write();
         if (state == State::SUCCESS) {
-            elem->value = val;
-            elem->lap.store(elem_lap + 1, std::memory_order_release);
-            size_.fetch_add(1, std::memory_order_relaxed);
+            ::new (static_cast<void *>(buf_.value(i))) T(val);
+            this->commit_write(i, elem_lap);
         }
         return state;
     }
 
     State try_push(T &&val)
     {
-        elem *elem;
-        uint16_t elem_lap;
+        Index i;
+        lap_type elem_lap;
         State state;
 
-        std::tie(elem, elem_lap, state) = this->select_4_write();
+        std::tie(i, elem_lap, state) = this->select_4_write();
         if (state == State::SUCCESS) {
-            elem->value = std::move(val);
-            elem->lap.store(elem_lap + 1, std::memory_order_release);
-            size_.fetch_add(1, std::memory_order_relaxed);
+            ::new (static_cast<void *>(buf_.value(i))) T(std::move(val));
+            this->commit_write(i, elem_lap);
         }
         return state;
     }
 
+    // T have to be default constructible to report a failed pop,
+    // see try_pop(T &) otherwise.
     std::tuple<T, State> try_pop()
     {
-        elem *elem;
-        uint16_t elem_lap;
+        Index i;
+        lap_type elem_lap;
         State state;
 
-        std::tie(elem, elem_lap, state) = this->select_4_read();
+        std::tie(i, elem_lap, state) = this->select_4_pop();
         if (state == State::SUCCESS) {
-            T out{ std::move(elem->value) };
-            elem->lap.store(elem_lap + 1, std::memory_order_release);
-            size_.fetch_add(-1, std::memory_order_relaxed);
+            T out{ std::move(*buf_.value(i)) };
+            buf_.value(i)->~T();
+            this->commit_read(i, elem_lap);
             return std::make_tuple(std::move(out), state);
         }
         return std::make_tuple(T{}, state);
     }
 
+    // Move the front element into out,
+    // out is left untouched when the pop fails.
+    State try_pop(T &out)
+    {
+        Index i;
+        lap_type elem_lap;
+        State state;
+
+        std::tie(i, elem_lap, state) = this->select_4_pop();
+        if (state == State::SUCCESS) {
+            out = std::move(*buf_.value(i));
+            buf_.value(i)->~T();
+            this->commit_read(i, elem_lap);
+        }
+        return state;
+    }
+
+    // Push val, wait while the queue is full.
+    // Return SUCCESS, or CLOSED once the queue is closed.
+    State push_wait(const T &val)
+    {
+        State state;
+        not_full_.wait([&] {
+            state = this->try_push(val);
+            return state != State::FULL;
+        });
+        return state;
+    }
+
+    State push_wait(T &&val)
+    {
+        State state;
+        not_full_.wait([&] {
+            state = this->try_push(std::move(val));
+            return state != State::FULL;
+        });
+        return state;
+    }
+
+    // Move the front element into out, wait while the queue is empty.
+    // Return SUCCESS, or CLOSED once the queue is closed and drained.
+    State pop_wait(T &out)
+    {
+        State state;
+        not_empty_.wait([&] {
+            state = this->try_pop(out);
+            return state != State::EMPTY;
+        });
+        return state;
+    }
+
+    // Same as pop_wait, return EMPTY when nothing was popped within timeout.
+    template <typename Rep, typename Period>
+    State pop_for(T &out, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return this->pop_until(out, std::chrono::steady_clock::now() + timeout);
+    }
+
+    // Same as pop_wait, return EMPTY when nothing was popped by deadline.
+    template <typename Clock, typename Duration>
+    State pop_until(T &out, const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        State state{ State::EMPTY };
+        auto popped = [&] {
+            state = this->try_pop(out);
+            return state != State::EMPTY;
+        };
+        not_empty_.wait_until(popped, deadline);
+        return state;
+    }
+
+    // Construct the element in place from args.
+    // The constructor of T must not throw, the element is already claimed when it runs.
+    template <typename... Args>
+    State try_emplace(Args &&...args)
+    {
+        Index i;
+        lap_type elem_lap;
+        State state;
+
+        std::tie(i, elem_lap, state) = this->select_4_write();
+        if (state == State::SUCCESS) {
+            ::new (static_cast<void *>(buf_.value(i))) T(std::forward<Args>(args)...);
+            this->commit_write(i, elem_lap);
+        }
+        return state;
+    }
+
+    // Claim the next element for writing in place,
+    // return nullptr when the queue is full or closed.
+    // The element is default-initialized, which leaves trivial types untouched.
+    // It is not visible to the consumer until commit() is called,
+    // only one element can be reserved at a time.
+    // Elements pushed in the meantime go after it.
+    T *reserve()
+    {
+        static_assert(std::is_default_constructible<T>::value,
+                      "T have to default constructor for reserve");
+        static_assert(!multi_producer::value, "reserve have to get a single producer");
+        State state;
+
+        assert(reserved_ == nullptr);
+        std::tie(reserved_index_, reserved_lap_, state) = this->select_4_write();
+        if (state == State::SUCCESS) {
+            reserved_ = ::new (static_cast<void *>(buf_.value(reserved_index_))) T;
+        }
+        return reserved_;
+    }
+
+    // Publish the element returned by reserve().
+    void commit()
+    {
+        assert(reserved_ != nullptr);
+        reserved_ = nullptr;
+        if (cached_index::value && held_ > 0) {
+            // Publish the reserved element and the ones held behind it but the last,
+            // commit_write publishes that one.
+            auto x{ sendX_.load(std::memory_order_relaxed) };
+            sendX_.store(extent_.advance(x, held_), std::memory_order_release);
+            held_ = 0;
+        }
+        this->commit_write(reserved_index_, reserved_lap_);
+    }
+
+    // Push elements of [first, last) until the queue is full,
+    // all of them are published with a single release operation.
+    // Elements are copied, pass move iterators to move them.
+    // A trivially copyable T is copied with memcpy when the iterators are pointers to T.
+    // Return the number of pushed elements.
+    template <typename ForwardIt>
+    std::size_t try_push_n(ForwardIt first, ForwardIt last)
+    {
+        position_type x;
+        Index n;
+        State state;
+
+        auto count{ std::distance(first, last) };
+        if (count <= 0) {
+            return 0;
+        }
+        auto max{ (std::size_t)count < extent_.capacity() ? (Index)count : extent_.capacity() };
+
+        std::tie(x, n, state) = this->select_n_4_write(max);
+        if (state == State::SUCCESS) {
+            this->write_n(x, n, first, bulk_copy<ForwardIt>{});
+            this->commit_n_write(x, n);
+        }
+        return n;
+    }
+
+    // Pop up to max elements into out,
+    // they are handed back to the producer with a single release operation.
+    // A trivially copyable T is copied with memcpy when out is a pointer to T.
+    // Return the number of popped elements.
+    template <typename OutputIt>
+    std::size_t try_pop_n(OutputIt out, std::size_t max)
+    {
+        position_type x;
+        Index n;
+        State state;
+
+        if (max == 0) {
+            return 0;
+        }
+        max = max < extent_.capacity() ? max : extent_.capacity();
+
+        std::tie(x, n, state) = this->select_n_4_read((Index)max);
+        if (state == State::SUCCESS) {
+            this->read_n(x, n, out, bulk_copy<OutputIt>{});
+            this->commit_n_read(x, n);
+        }
+        return n;
+    }
+
+    // Return the front element without removing it,
+    // or nullptr when the queue is empty.
     T *try_peek()
     {
-        elem *elem;
+        static_assert(!multi_consumer::value, "try_peek have to get a single consumer");
+        Index i;
         State state;
 
-        std::tie(elem, std::ignore, state) = this->select_4_read();
+        std::tie(i, std::ignore, state) = this->select_4_read();
         if (state == State::SUCCESS) {
-            return &elem->value;
+            return buf_.value(i);
         }
         return nullptr;
     }
 
-    void close()
+    // Return a view of up to max ready elements at the front of the queue.
+    // The elements stay in the queue and can be processed in place
+    // until release() hands them back to the producer.
+    view try_peek_n(std::size_t max)
     {
-        auto x{ sendX_.load(std::memory_order_acquire) };
-        auto new_x{ x | kMask32 };
-        auto m1{ std::memory_order_acquire };
-        auto m2{ std::memory_order_relaxed };
+        static_assert(!multi_consumer::value, "try_peek_n have to get a single consumer");
+        position_type x;
+        Index n;
+
+        if (max == 0) {
+            return view{};
+        }
+        max = max < extent_.capacity() ? max : extent_.capacity();
+
+        std::tie(x, n, std::ignore) = this->select_n_4_read((Index)max);
+        return view{ this, x, n };
+    }
 
-        while (!sendX_.compare_exchange_weak(x, new_x, m1, m2)) {
-            delay(10);
+    // Remove n elements from the front of the queue,
+    // n must not exceed the size of the last view returned by try_peek_n().
+    void release(std::size_t n)
+    {
+        static_assert(!multi_consumer::value, "release have to get a single consumer");
+        if (n > 0) {
+            auto x{ recvX_.load(std::memory_order_relaxed) };
+            auto y{ x };
+            for (std::size_t i = 0; i < n; i++, y = extent_.next(y)) {
+                buf_.value(extent_.index(y))->~T();
+            }
+            this->commit_n_read(x, (Index)n);
         }
     }
 
-    uint32_t len() const noexcept { return size_.load(std::memory_order_relaxed); }
+    // Set the closed flag and wake the waiting threads, from any thread.
+    // Pushes return CLOSED from then on, pops return CLOSED once the queue is drained.
+    void close()
+    {
+        closed_.store(true, std::memory_order_release);
+        not_empty_.notify();
+        not_full_.notify();
+    }
 
-    bool is_close() const noexcept
+    std::size_t len() const noexcept
     {
-        return (sendX_.load(std::memory_order_relaxed) & kMask32) != 0;
+        if (Policy::size_counter) {
+            return size_.load();
+        }
+        // Load the receive position first, it never passes the send position.
+        auto recv{ recvX_.load(std::memory_order_acquire) };
+        auto send{ sendX_.load(std::memory_order_acquire) };
+        auto size{ extent_.distance(send, recv) };
+        return size < extent_.capacity() ? size : extent_.capacity();
     }
+
+    // Backing of the ring buffer that was obtained,
+    // HEAP when the pages could not be mapped.
+    Backing backing() const noexcept { return buf_.backing(); }
+
+    // NUMA node of the ring buffer, -1 when unknown or before the first value is written.
+    int node() const noexcept { return detail::numa_node_of(buf_.value(0)); }
+
+    // Wait strategy notified by pushes, e.g. the fd of eventfd_notify for an event loop.
+    Wait &readable() noexcept { return not_empty_; }
+
+    // Wait strategy notified by pops.
+    Wait &writable() noexcept { return not_full_; }
+
+    bool is_close() const noexcept { return closed_.load(std::memory_order_relaxed); }
 };
+
+#if defined(T2_QUEUE_PMR)
+namespace pmr {
+// queue with the ring buffer from a std::pmr::memory_resource,
+//   std::pmr::monotonic_buffer_resource arena{ ... };
+//   t2::pmr::queue<int32_t> q{ 1024, &arena };
+template <typename T,
+          std::size_t N = dynamic_extent,
+          typename Index = uint16_t,
+          typename Policy = spsc,
+          typename Wait = busy_spin,
+          typename Layout = soa>
+using queue = t2::queue<T, N, Index, Policy, Wait, Layout, std::pmr::polymorphic_allocator<T>>;
+} // namespace pmr
+#endif
 } // namespace t2
 
 #endif // QUEUE_HPP
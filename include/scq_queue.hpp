@@ -0,0 +1,347 @@
+//
+// Bounded MPMC queue on fetch-and-add tickets (SCQ, Nikolaev 2019).
+//
+
+#ifndef SCQ_QUEUE_HPP
+#define SCQ_QUEUE_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+
+#include "cache_padded.h"
+#include "queue.hpp"
+
+namespace t2 {
+namespace detail {
+constexpr unsigned log2(std::size_t n) noexcept
+{
+    return n <= 1 ? 0 : 1 + log2(n >> 1);
+}
+
+// Ring of element indices of the SCQ algorithm.
+// Every push or pop takes a ticket with a fetch_add on tail_ or head_ and only retries on
+// the entry of that ticket, so producers never loop on a CAS of a shared position.
+// The ring has 2n entries for at most n indices. An entry holds, from the top bit down,
+// the cycle of its ticket, the safe flag and the index, all ones in the index bits mark
+// an empty entry.
+class scq_ring
+{
+    using entry_type = std::size_t;
+    using diff_type = std::ptrdiff_t;
+
+    // consecutive tickets are spread over this many bits of the entry index,
+    // so they land on different cache lines
+    static const unsigned kRemapBits = log2(CACHE_PADDED / sizeof(entry_type));
+
+    // log2 of the number of entries
+    unsigned order_;
+
+    std::unique_ptr<std::atomic<entry_type>[]> entries_;
+
+    alignas(CACHE_PADDED) std::atomic<entry_type> head_{ 0 };
+
+    alignas(CACHE_PADDED) std::atomic<entry_type> tail_{ 0 };
+
+    // failed pops left before the ring is reported empty,
+    // negative while the ring has never been filled
+    alignas(CACHE_PADDED) std::atomic<diff_type> threshold_{ -1 };
+
+    entry_type ring_size() const noexcept { return entry_type{ 1 } << order_; }
+
+    diff_type threshold3() const noexcept { return (diff_type)(ring_size() / 2 * 3 - 1); }
+
+    // Tickets and cycles wrap, compare them by their distance.
+    static bool before(entry_type a, entry_type b) noexcept { return (diff_type)(a - b) < 0; }
+
+    std::atomic<entry_type> &entry(entry_type ticket) noexcept
+    {
+        auto i{ ticket & (ring_size() - 1) };
+        if (order_ <= kRemapBits) {
+            return entries_[i];
+        }
+        return entries_[(i >> (order_ - kRemapBits)) | ((i << kRemapBits) & (ring_size() - 1))];
+    }
+
+    // move the tail to the head after pops overtook it
+    void catchup(entry_type tail, entry_type head) noexcept
+    {
+        auto m1{ std::memory_order_acq_rel };
+        auto m2{ std::memory_order_acquire };
+        while (!tail_.compare_exchange_weak(tail, head, m1, m2)) {
+            head = head_.load(std::memory_order_acquire);
+            tail = tail_.load(std::memory_order_acquire);
+            if (!before(tail, head)) {
+                break;
+            }
+        }
+    }
+
+public:
+    // A ring of 2^order entries which holds the indices 0 .. count - 1,
+    // count <= 2^(order - 1).
+    scq_ring(unsigned order, std::size_t count)
+        : order_{ order }, entries_{ new std::atomic<entry_type>[entry_type{ 1 } << order] }
+    {
+        auto n{ ring_size() };
+        for (entry_type i = 0; i < n; i++) {
+            // Index i is pushed with ticket i, an empty entry is on the cycle before all tickets.
+            entry(i).store(i < count ? n + i : ~entry_type{ 0 }, std::memory_order_relaxed);
+        }
+        tail_.store(count, std::memory_order_relaxed);
+        threshold_.store(count > 0 ? threshold3() : -1, std::memory_order_relaxed);
+    }
+
+    // The ring always has room for all indices, push never fails.
+    void push(std::size_t index) noexcept
+    {
+        auto n{ ring_size() };
+        auto m1{ std::memory_order_acq_rel };
+        auto m2{ std::memory_order_acquire };
+
+        index ^= n - 1;
+        while (true) {
+            auto tail{ tail_.fetch_add(1, std::memory_order_acq_rel) };
+            auto tcycle{ (tail << 1) | (2 * n - 1) };
+            auto &slot = entry(tail);
+            auto e{ slot.load(std::memory_order_acquire) };
+
+            while (true) {
+                auto ecycle{ e | (2 * n - 1) };
+                // The entry is empty, and it is safe or no pop has passed this ticket yet.
+                auto empty{ e == ecycle
+                            || (e == (ecycle ^ n)
+                                && !before(tail, head_.load(std::memory_order_acquire))) };
+                if (!before(ecycle, tcycle) || !empty) {
+                    // The entry is used on this cycle, take the next ticket.
+                    break;
+                }
+                if (slot.compare_exchange_weak(e, tcycle ^ index, m1, m2)) {
+                    if (threshold_.load(std::memory_order_acquire) != threshold3()) {
+                        threshold_.store(threshold3(), std::memory_order_release);
+                    }
+                    return;
+                }
+            }
+        }
+    }
+
+    bool pop(std::size_t &index) noexcept
+    {
+        auto n{ ring_size() };
+        auto m1{ std::memory_order_acq_rel };
+        auto m2{ std::memory_order_acquire };
+
+        if (threshold_.load(std::memory_order_acquire) < 0) {
+            return false;
+        }
+        while (true) {
+            auto head{ head_.fetch_add(1, std::memory_order_acq_rel) };
+            auto hcycle{ (head << 1) | (2 * n - 1) };
+            auto &slot = entry(head);
+            auto e{ slot.load(std::memory_order_acquire) };
+
+            while (true) {
+                auto ecycle{ e | (2 * n - 1) };
+                if (ecycle == hcycle) {
+                    // The entry was pushed with this ticket, empty it.
+                    slot.fetch_or(n - 1, std::memory_order_acq_rel);
+                    index = e & (n - 1);
+                    return true;
+                }
+
+                entry_type e_new;
+                if ((e | n) != ecycle) {
+                    // The entry holds an index of an older cycle,
+                    // mark it unsafe so that a late push of this cycle skips it.
+                    e_new = e & ~n;
+                    if (e == e_new) {
+                        break;
+                    }
+                } else {
+                    // The entry is empty, move it to this cycle.
+                    e_new = hcycle ^ (~e & n);
+                }
+                if (!before(ecycle, hcycle) || slot.compare_exchange_weak(e, e_new, m1, m2)) {
+                    break;
+                }
+            }
+
+            auto tail{ tail_.load(std::memory_order_acquire) };
+            if (!before(head + 1, tail)) {
+                // The pop overtook all pushes.
+                catchup(tail, head + 1);
+                threshold_.fetch_sub(1, std::memory_order_acq_rel);
+                return false;
+            }
+            if (threshold_.fetch_sub(1, std::memory_order_acq_rel) <= 0) {
+                return false;
+            }
+        }
+    }
+
+    // number of pushed indices, approximate while pops are racing
+    std::size_t len() const noexcept
+    {
+        auto head{ head_.load(std::memory_order_acquire) };
+        auto tail{ tail_.load(std::memory_order_acquire) };
+        return before(head, tail) ? tail - head : 0;
+    }
+};
+} // namespace detail
+
+// Bounded MPMC queue of T which scales with the number of producers and consumers.
+// Values stay in their element, a ring of free indices and a ring of used indices
+// pass the element between threads.
+template <typename T>
+class scq_queue
+{
+private:
+    struct elem
+    {
+        // User data,
+        // constructed by push and destroyed by pop
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T *value() noexcept { return reinterpret_cast<T *>(storage); }
+    };
+
+    // smallest ring order with room for 2 * cap entries
+    static unsigned ring_order(std::size_t cap) noexcept
+    {
+        unsigned order{ 1 };
+        while ((std::size_t{ 1 } << (order - 1)) < cap) {
+            order++;
+        }
+        return order;
+    }
+
+    std::size_t cap_;
+
+    std::unique_ptr<elem[]> buf_;
+
+    // indices of elements holding values, in push order
+    detail::scq_ring used_;
+
+    // indices of free elements
+    detail::scq_ring free_;
+
+    alignas(CACHE_PADDED) std::atomic<bool> closed_{ false };
+
+    // pop the index of a used element,
+    // EMPTY becomes CLOSED once the queue is closed and drained
+    State pop_index(std::size_t &index) noexcept
+    {
+        if (used_.pop(index)) {
+            return State::SUCCESS;
+        }
+        if (!closed_.load(std::memory_order_acquire)) {
+            return State::EMPTY;
+        }
+        // Retry once, the pushes before close() are visible now.
+        return used_.pop(index) ? State::SUCCESS : State::CLOSED;
+    }
+
+public:
+    explicit scq_queue(std::size_t cap)
+        : cap_{ cap }, buf_{ new elem[cap] }, used_{ ring_order(cap), 0 },
+          free_{ ring_order(cap), cap }
+    {
+        static_assert(std::is_move_constructible<T>::value, "T have to move constructor for pop");
+        assert(cap > 0);
+    }
+
+    ~scq_queue()
+    {
+        if (std::is_trivially_destructible<T>::value) {
+            return;
+        }
+        std::size_t index;
+        while (used_.pop(index)) {
+            buf_[index].value()->~T();
+        }
+    }
+
+    State try_push(const T &val)
+    {
+        std::size_t index;
+
+        if (closed_.load(std::memory_order_relaxed)) {
+            return State::CLOSED;
+        }
+        if (!free_.pop(index)) {
+            return State::FULL;
+        }
+        ::new (static_cast<void *>(buf_[index].value())) T(val);
+        used_.push(index);
+        return State::SUCCESS;
+    }
+
+    State try_push(T &&val)
+    {
+        std::size_t index;
+
+        if (closed_.load(std::memory_order_relaxed)) {
+            return State::CLOSED;
+        }
+        if (!free_.pop(index)) {
+            return State::FULL;
+        }
+        ::new (static_cast<void *>(buf_[index].value())) T(std::move(val));
+        used_.push(index);
+        return State::SUCCESS;
+    }
+
+    // T have to be default constructible to report a failed pop,
+    // see try_pop(T &) otherwise.
+    std::tuple<T, State> try_pop()
+    {
+        std::size_t index;
+
+        auto state{ this->pop_index(index) };
+        if (state != State::SUCCESS) {
+            return std::make_tuple(T{}, state);
+        }
+        T out{ std::move(*buf_[index].value()) };
+        buf_[index].value()->~T();
+        free_.push(index);
+        return std::make_tuple(std::move(out), State::SUCCESS);
+    }
+
+    // Move the front element into out,
+    // out is left untouched when the pop fails.
+    State try_pop(T &out)
+    {
+        std::size_t index;
+
+        auto state{ this->pop_index(index) };
+        if (state != State::SUCCESS) {
+            return state;
+        }
+        out = std::move(*buf_[index].value());
+        buf_[index].value()->~T();
+        free_.push(index);
+        return State::SUCCESS;
+    }
+
+    // Pushes return CLOSED from then on, pops return CLOSED once the queue is drained.
+    void close() noexcept { closed_.store(true, std::memory_order_release); }
+
+    std::size_t capacity() const noexcept { return cap_; }
+
+    // approximate while other threads push or pop
+    std::size_t len() const noexcept
+    {
+        auto size{ used_.len() };
+        return size < cap_ ? size : cap_;
+    }
+
+    bool is_close() const noexcept { return closed_.load(std::memory_order_relaxed); }
+};
+} // namespace t2
+
+#endif // SCQ_QUEUE_HPP
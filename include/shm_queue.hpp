@@ -0,0 +1,270 @@
+//
+// SPSC queue between processes in a shared memory region (Linux).
+//
+
+#ifndef SHM_QUEUE_HPP
+#define SHM_QUEUE_HPP
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache_padded.h"
+#include "queue.hpp"
+
+namespace t2 {
+// Queue of T for one producer process and one consumer process.
+// The region holds a header and the values, the header only has fixed-size fields and
+// offsets from the start of the region, so every process can map it at its own address.
+// Each process keeps a private copy of the opposite position, the shared positions are
+// only read when the ring looks full or empty.
+// Make the region with shm_open (create(name, cap), link with -lrt before glibc 2.34)
+// or memfd_create and hand the fd to the other process (create(fd, cap)).
+template <typename T>
+class shm_queue
+{
+private:
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T have to be trivially copyable to cross processes");
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+                  "shm_queue have to get lock-free atomics");
+
+    static const uint32_t kMagic = 0x74327173;
+    static const uint32_t kVersion = 1;
+
+    // Start of the region.
+    struct header
+    {
+        // written last by create, attach fails until then
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint64_t header_size;
+        uint64_t capacity;
+        uint64_t elem_size;
+        uint64_t values_offset;
+
+        // Producer-owned.
+        alignas(CACHE_PADDED) std::atomic<uint64_t> send;
+
+        // Consumer-owned.
+        alignas(CACHE_PADDED) std::atomic<uint64_t> recv;
+
+        alignas(CACHE_PADDED) std::atomic<uint32_t> closed;
+    };
+
+    void *region_;
+    std::size_t size_;
+
+    header *hdr_;
+    T *values_;
+    uint64_t mask_;
+
+    // Copies of the positions, each process only uses the one of its side.
+    // producer's copy of hdr_->recv
+    uint64_t recv_cache_{ 0 };
+    // consumer's copy of hdr_->send
+    uint64_t send_cache_{ 0 };
+
+    shm_queue(void *region, std::size_t size) noexcept
+        : region_{ region }, size_{ size }, hdr_{ static_cast<header *>(region) },
+          values_{ nullptr }, mask_{ 0 }
+    {
+    }
+
+    static std::unique_ptr<shm_queue> map(int fd, std::size_t size)
+    {
+        auto region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (region == MAP_FAILED) {
+            return nullptr;
+        }
+        return std::unique_ptr<shm_queue>(new shm_queue(region, size));
+    }
+
+    // point at the values described by the header
+    void bind() noexcept
+    {
+        values_ = reinterpret_cast<T *>(static_cast<unsigned char *>(region_)
+                                        + hdr_->values_offset);
+        mask_ = hdr_->capacity - 1;
+        recv_cache_ = hdr_->recv.load(std::memory_order_acquire);
+        send_cache_ = hdr_->send.load(std::memory_order_acquire);
+    }
+
+    bool valid() const noexcept
+    {
+        auto cap{ hdr_->capacity };
+        return hdr_->magic.load(std::memory_order_acquire) == kMagic
+               && hdr_->version == kVersion && hdr_->header_size == sizeof(header)
+               && hdr_->elem_size == sizeof(T) && cap > 0 && (cap & (cap - 1)) == 0
+               && hdr_->values_offset % alignof(T) == 0 && hdr_->values_offset >= sizeof(header)
+               && hdr_->values_offset <= size_ && cap <= (size_ - hdr_->values_offset) / sizeof(T);
+    }
+
+public:
+    shm_queue(const shm_queue &) = delete;
+    shm_queue &operator=(const shm_queue &) = delete;
+
+    // Unmap the region, the queue lives on in the other processes and in the fd.
+    ~shm_queue() { ::munmap(region_, size_); }
+
+    // Size fd for a queue of cap elements, rounded up to a power of two, and set it up.
+    // Return nullptr when fd cannot be sized or mapped.
+    static std::unique_ptr<shm_queue> create(int fd, std::size_t cap)
+    {
+        assert(cap > 0);
+        uint64_t pow2{ 1 };
+        while (pow2 < cap) {
+            pow2 <<= 1;
+        }
+        auto values_offset{ (sizeof(header) + alignof(T) - 1) / alignof(T) * alignof(T) };
+        auto size{ values_offset + pow2 * sizeof(T) };
+        if (::ftruncate(fd, (off_t)size) != 0) {
+            return nullptr;
+        }
+
+        auto q = map(fd, size);
+        if (q == nullptr) {
+            return nullptr;
+        }
+        auto hdr = ::new (q->region_) header;
+        hdr->version = kVersion;
+        hdr->header_size = sizeof(header);
+        hdr->capacity = pow2;
+        hdr->elem_size = sizeof(T);
+        hdr->values_offset = values_offset;
+        hdr->send.store(0, std::memory_order_relaxed);
+        hdr->recv.store(0, std::memory_order_relaxed);
+        hdr->closed.store(0, std::memory_order_relaxed);
+        hdr->magic.store(kMagic, std::memory_order_release);
+        q->bind();
+        return q;
+    }
+
+    // Map the queue set up by create(fd, cap) in another process.
+    // Return nullptr when fd does not hold a queue of T.
+    static std::unique_ptr<shm_queue> attach(int fd)
+    {
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(header)) {
+            return nullptr;
+        }
+
+        auto q = map(fd, (std::size_t)st.st_size);
+        if (q == nullptr || !q->valid()) {
+            return nullptr;
+        }
+        q->bind();
+        return q;
+    }
+
+    // Same as create(fd, cap) on a new POSIX shared memory object,
+    // which stays until shm_unlink(name).
+    static std::unique_ptr<shm_queue> create(const char *name, std::size_t cap)
+    {
+        auto fd{ ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600) };
+        if (fd < 0) {
+            return nullptr;
+        }
+        auto q = create(fd, cap);
+        ::close(fd);
+        if (q == nullptr) {
+            ::shm_unlink(name);
+        }
+        return q;
+    }
+
+    static std::unique_ptr<shm_queue> attach(const char *name)
+    {
+        auto fd{ ::shm_open(name, O_RDWR, 0) };
+        if (fd < 0) {
+            return nullptr;
+        }
+        auto q = attach(fd);
+        ::close(fd);
+        return q;
+    }
+
+    State try_push(const T &val)
+    {
+        if (hdr_->closed.load(std::memory_order_relaxed) != 0) {
+            return State::CLOSED;
+        }
+        auto x{ hdr_->send.load(std::memory_order_relaxed) };
+        if (x - recv_cache_ > mask_) {
+            recv_cache_ = hdr_->recv.load(std::memory_order_acquire);
+            if (x - recv_cache_ > mask_) {
+                return State::FULL;
+            }
+        }
+        std::memcpy(static_cast<void *>(&values_[x & mask_]), &val, sizeof(T));
+        hdr_->send.store(x + 1, std::memory_order_release);
+        return State::SUCCESS;
+    }
+
+    // T have to be default constructible to report a failed pop,
+    // see try_pop(T &) otherwise.
+    std::tuple<T, State> try_pop()
+    {
+        T out{};
+        auto state{ this->try_pop(out) };
+        return std::make_tuple(out, state);
+    }
+
+    // Copy the front element into out,
+    // out is left untouched when the pop fails.
+    // Return CLOSED once the queue is closed and drained.
+    State try_pop(T &out)
+    {
+        auto x{ hdr_->recv.load(std::memory_order_relaxed) };
+        if (x == send_cache_) {
+            send_cache_ = hdr_->send.load(std::memory_order_acquire);
+            if (x == send_cache_) {
+                if (hdr_->closed.load(std::memory_order_acquire) == 0) {
+                    return State::EMPTY;
+                }
+                // Retry once, the pushes before close() are visible now.
+                send_cache_ = hdr_->send.load(std::memory_order_acquire);
+                if (x == send_cache_) {
+                    return State::CLOSED;
+                }
+            }
+        }
+        std::memcpy(static_cast<void *>(&out), &values_[x & mask_], sizeof(T));
+        hdr_->recv.store(x + 1, std::memory_order_release);
+        return State::SUCCESS;
+    }
+
+    // Pushes return CLOSED from then on, pops return CLOSED once the queue is drained.
+    // Call it from the producer process.
+    void close() noexcept { hdr_->closed.store(1, std::memory_order_release); }
+
+    std::size_t capacity() const noexcept { return (std::size_t)hdr_->capacity; }
+
+    std::size_t len() const noexcept
+    {
+        // Load the receive position first, it never passes the send position.
+        auto recv{ hdr_->recv.load(std::memory_order_acquire) };
+        auto send{ hdr_->send.load(std::memory_order_acquire) };
+        return (std::size_t)(send - recv);
+    }
+
+    bool is_close() const noexcept { return hdr_->closed.load(std::memory_order_relaxed) != 0; }
+};
+} // namespace t2
+
+#endif // __linux__
+
+#endif // SHM_QUEUE_HPP
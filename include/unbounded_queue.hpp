@@ -0,0 +1,186 @@
+//
+// Unbounded SPSC queue on a linked list of fixed-size ring segments.
+//
+
+#ifndef UNBOUNDED_QUEUE_HPP
+#define UNBOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <utility>
+
+#include "cache_padded.h"
+#include "queue.hpp"
+
+namespace t2 {
+// Unbounded queue of T for one producer thread and one consumer thread.
+// The producer appends a new segment of SegN elements when the last one is full,
+// the consumer moves to the next segment when its segment is drained.
+// Drained segments are reused by the producer instead of being freed,
+// so once the queue has grown to its working size push and pop do not allocate.
+template <typename T, std::size_t SegN = 1024>
+class unbounded_queue
+{
+private:
+    struct segment
+    {
+        queue<T, SegN> ring;
+
+        // set by the producer once it moved on to the next segment
+        std::atomic<segment *> next{ nullptr };
+
+        // allocation that holds the segment
+        void *raw{ nullptr };
+    };
+
+    // The positions of a segment are aligned to CACHE_PADDED,
+    // plain new only honours that since C++17.
+    static segment *new_segment()
+    {
+        struct guard
+        {
+            void *raw;
+            ~guard() { ::operator delete(raw); }
+        };
+
+        auto space{ sizeof(segment) + alignof(segment) };
+        guard g{ ::operator new(space) };
+        void *p = g.raw;
+        std::align(alignof(segment), sizeof(segment), p, space);
+        auto seg = ::new (p) segment;
+        seg->raw = g.raw;
+        g.raw = nullptr;
+        return seg;
+    }
+
+    static void delete_segment(segment *seg)
+    {
+        auto raw = seg->raw;
+        seg->~segment();
+        ::operator delete(raw);
+    }
+
+    // Producer-owned.
+    // oldest segment, the segments from first_ up to head_ are drained
+    alignas(CACHE_PADDED) segment *first_;
+
+    // segment the producer pushes to
+    segment *tail_;
+
+    // Consumer-owned.
+    // segment the consumer pops from
+    alignas(CACHE_PADDED) std::atomic<segment *> head_;
+
+    alignas(CACHE_PADDED) std::atomic<bool> closed_{ false };
+
+    // an empty segment, a drained one when there is one
+    segment *next_segment()
+    {
+        if (first_ != head_.load(std::memory_order_acquire)) {
+            // The consumer has left this segment for good.
+            auto seg = first_;
+            first_ = seg->next.load(std::memory_order_relaxed);
+            seg->next.store(nullptr, std::memory_order_relaxed);
+            return seg;
+        }
+        return new_segment();
+    }
+
+    template <typename U>
+    State push(U &&val)
+    {
+        if (closed_.load(std::memory_order_relaxed)) {
+            return State::CLOSED;
+        }
+        if (tail_->ring.try_push(std::forward<U>(val)) == State::SUCCESS) {
+            return State::SUCCESS;
+        }
+
+        // The segment is full, val is still untouched.
+        auto seg = next_segment();
+        seg->ring.try_push(std::forward<U>(val));
+        tail_->next.store(seg, std::memory_order_release);
+        tail_ = seg;
+        return State::SUCCESS;
+    }
+
+    State pop(T &out)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto state{ head->ring.try_pop(out) };
+        if (state != State::EMPTY) {
+            return state;
+        }
+
+        auto next = head->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return State::EMPTY;
+        }
+        // The producer moved on after its last push to this segment,
+        // pop once more to drain it.
+        state = head->ring.try_pop(out);
+        if (state != State::EMPTY) {
+            return state;
+        }
+        head_.store(next, std::memory_order_release);
+        return next->ring.try_pop(out);
+    }
+
+public:
+    unbounded_queue() : first_{ new_segment() }, tail_{ first_ }, head_{ first_ } { }
+
+    unbounded_queue(const unbounded_queue &) = delete;
+    unbounded_queue &operator=(const unbounded_queue &) = delete;
+
+    ~unbounded_queue()
+    {
+        auto seg = first_;
+        while (seg != nullptr) {
+            auto next = seg->next.load(std::memory_order_relaxed);
+            delete_segment(seg);
+            seg = next;
+        }
+    }
+
+    // Never FULL, allocates a segment when all of them are in use.
+    State try_push(const T &val) { return this->push(val); }
+
+    State try_push(T &&val) { return this->push(std::move(val)); }
+
+    // T have to be default constructible to report a failed pop,
+    // see try_pop(T &) otherwise.
+    std::tuple<T, State> try_pop()
+    {
+        T out{};
+        auto state{ this->try_pop(out) };
+        return std::make_tuple(std::move(out), state);
+    }
+
+    // Move the front element into out,
+    // out is left untouched when the pop fails.
+    // Return CLOSED once the queue is closed and drained.
+    State try_pop(T &out)
+    {
+        auto state{ this->pop(out) };
+        if (state == State::EMPTY && closed_.load(std::memory_order_acquire)) {
+            // Retry once, the pushes before close() are visible now.
+            state = this->pop(out);
+            if (state == State::EMPTY) {
+                state = State::CLOSED;
+            }
+        }
+        return state;
+    }
+
+    // Pushes return CLOSED from then on, pops return CLOSED once the queue is drained.
+    // Call it from the producer thread.
+    void close() noexcept { closed_.store(true, std::memory_order_release); }
+
+    bool is_close() const noexcept { return closed_.load(std::memory_order_relaxed); }
+};
+} // namespace t2
+
+#endif // UNBOUNDED_QUEUE_HPP
@@ -0,0 +1,397 @@
+//
+// Wait strategies for the blocking calls of t2::queue.
+//
+
+#ifndef WAIT_STRATEGY_HPP
+#define WAIT_STRATEGY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// T2_HAS_THREADS is 0 on toolchains without std::thread, e.g. a bare-metal libstdc++ built
+// without gthreads, which leaves out spin_yield and the futex_park off Linux.
+#if !defined(T2_HAS_THREADS)
+#  if defined(__GLIBCXX__) && !defined(_GLIBCXX_HAS_GTHREADS)
+#    define T2_HAS_THREADS 0
+#  else
+#    define T2_HAS_THREADS 1
+#  endif
+#endif
+
+#if T2_HAS_THREADS
+#  include <thread>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#  include <cerrno>
+#  include <climits>
+#  include <ctime>
+#  include <system_error>
+#  include <linux/futex.h>
+#  include <poll.h>
+#  include <sys/eventfd.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#elif T2_HAS_THREADS
+#  include <condition_variable>
+#  include <mutex>
+#endif
+
+// A wait strategy has
+//   template <typename Pred> void wait(Pred pred);
+//   template <typename Pred, typename Clock, typename Duration>
+//   bool wait_until(Pred pred, const std::chrono::time_point<Clock, Duration> &deadline);
+//   void notify() noexcept;
+// wait returns once pred() is true, wait_until also returns false at the deadline.
+// pred may have side effects, it is how the queue retries a push or a pop.
+// notify is called after every push (pop) that may let a waiting pop (push) through.
+
+namespace t2 {
+namespace detail {
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__) || (defined(__arm__) && __ARM_ARCH >= 7)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+} // namespace detail
+
+// Spin on the condition.
+// Lowest latency, burns a core while waiting.
+struct busy_spin
+{
+    template <typename Pred>
+    void wait(Pred pred)
+    {
+        while (!pred()) { }
+    }
+
+    template <typename Pred, typename Clock, typename Duration>
+    bool wait_until(Pred pred, const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        while (!pred()) {
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void notify() noexcept { }
+};
+
+// Spin with a pause instruction between the tries,
+// which saves power and leaves the core to its hyper-thread sibling.
+struct spin_pause
+{
+    template <typename Pred>
+    void wait(Pred pred)
+    {
+        while (!pred()) {
+            detail::cpu_relax();
+        }
+    }
+
+    template <typename Pred, typename Clock, typename Duration>
+    bool wait_until(Pred pred, const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        while (!pred()) {
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+            detail::cpu_relax();
+        }
+        return true;
+    }
+
+    void notify() noexcept { }
+};
+
+#if T2_HAS_THREADS
+// Spin for a while, then yield the thread to the scheduler between the tries.
+struct spin_yield
+{
+    static const int kSpins = 64;
+
+    template <typename Pred>
+    void wait(Pred pred)
+    {
+        for (int i = 0; !pred(); i++) {
+            if (i < kSpins) {
+                detail::cpu_relax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    template <typename Pred, typename Clock, typename Duration>
+    bool wait_until(Pred pred, const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        for (int i = 0; !pred(); i++) {
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+            if (i < kSpins) {
+                detail::cpu_relax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        return true;
+    }
+
+    void notify() noexcept { }
+};
+#endif
+
+#if defined(__linux__) || T2_HAS_THREADS
+// Spin for a while, then park the thread on a futex (a condition variable off Linux).
+// notify only makes a system call when a thread is parked,
+// otherwise it costs a fence and a load.
+class futex_park
+{
+    static const int kSpins = 128;
+
+    // bumped by notify when there are waiters
+    std::atomic<uint32_t> seq_{ 0 };
+
+    // threads between prepare_park and the end of their park
+    std::atomic<uint32_t> waiters_{ 0 };
+
+#if !defined(__linux__)
+    std::mutex mutex_;
+    std::condition_variable cv_;
+#endif
+
+    // Register as a waiter before the last check of the condition,
+    // a notify after that check changes the returned sequence and ends the park.
+    uint32_t prepare_park() noexcept
+    {
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return seq_.load(std::memory_order_acquire);
+    }
+
+    void finish_park() noexcept { waiters_.fetch_sub(1, std::memory_order_relaxed); }
+
+#if defined(__linux__)
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex have to be 32 bits");
+
+    void park(uint32_t seq, const struct timespec *timeout) noexcept
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq_), FUTEX_WAIT_PRIVATE, seq, timeout,
+                nullptr, 0);
+    }
+
+    void park(uint32_t seq) noexcept { park(seq, nullptr); }
+
+    template <typename Rep, typename Period>
+    void park_for(uint32_t seq, const std::chrono::duration<Rep, Period> &timeout) noexcept
+    {
+        auto ns{ std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count() };
+        struct timespec ts;
+        ts.tv_sec = (time_t)(ns / 1000000000);
+        ts.tv_nsec = (long)(ns % 1000000000);
+        park(seq, &ts);
+    }
+
+    void wake() noexcept
+    {
+        seq_.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq_), FUTEX_WAKE_PRIVATE, INT_MAX,
+                nullptr, nullptr, 0);
+    }
+#else
+    void park(uint32_t seq)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (seq_.load(std::memory_order_relaxed) == seq) {
+            cv_.wait(lock);
+        }
+    }
+
+    template <typename Rep, typename Period>
+    void park_for(uint32_t seq, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (seq_.load(std::memory_order_relaxed) == seq) {
+            cv_.wait_for(lock, timeout);
+        }
+    }
+
+    void wake()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            seq_.fetch_add(1, std::memory_order_release);
+        }
+        cv_.notify_all();
+    }
+#endif
+
+public:
+    template <typename Pred>
+    void wait(Pred pred)
+    {
+        for (int i = 0; i < kSpins; i++) {
+            if (pred()) {
+                return;
+            }
+            detail::cpu_relax();
+        }
+        while (true) {
+            auto seq{ prepare_park() };
+            if (pred()) {
+                finish_park();
+                return;
+            }
+            park(seq);
+            finish_park();
+        }
+    }
+
+    template <typename Pred, typename Clock, typename Duration>
+    bool wait_until(Pred pred, const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        for (int i = 0; i < kSpins; i++) {
+            if (pred()) {
+                return true;
+            }
+            detail::cpu_relax();
+        }
+        while (true) {
+            auto seq{ prepare_park() };
+            if (pred()) {
+                finish_park();
+                return true;
+            }
+            auto now{ Clock::now() };
+            if (now >= deadline) {
+                finish_park();
+                return false;
+            }
+            park_for(seq, deadline - now);
+            finish_park();
+        }
+    }
+
+    void notify() noexcept
+    {
+        // Pairs with the fence in prepare_park,
+        // either the waiter sees the new state or this sees the waiter.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) != 0) {
+            wake();
+        }
+    }
+};
+#endif
+
+#if defined(__linux__)
+// Signal through an eventfd, so an event loop can wait for the queue with epoll or poll.
+// The fd becomes readable when the other side makes progress, e.g. the first push into an
+// empty queue. Later pushes do not write to it again until the event loop calls arm(),
+// so a burst costs one system call. The event loop calls arm() before it drains the queue:
+//   q.readable().arm();
+//   while (q.try_pop(v) == t2::State::SUCCESS) { ... }
+// Blocking calls poll the fd, which wakes one waiting thread per signal.
+class eventfd_notify
+{
+    int fd_;
+
+    // set once the fd is signalled, cleared by arm()
+    std::atomic<bool> signaled_{ false };
+
+    void poll_for(int timeout_ms) noexcept
+    {
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ::poll(&pfd, 1, timeout_ms);
+    }
+
+public:
+    // Throws std::system_error when the eventfd cannot be created, e.g. out of descriptors.
+    eventfd_notify() : fd_{ ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) }
+    {
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "eventfd");
+        }
+    }
+
+    eventfd_notify(const eventfd_notify &) = delete;
+    eventfd_notify &operator=(const eventfd_notify &) = delete;
+
+    ~eventfd_notify() { ::close(fd_); }
+
+    int fd() const noexcept { return fd_; }
+
+    // Consume the signal, the next notify writes to the fd again.
+    void arm() noexcept
+    {
+        uint64_t count;
+        while (::read(fd_, &count, sizeof(count)) < 0 && errno == EINTR) { }
+        signaled_.store(false, std::memory_order_relaxed);
+        // Pairs with the fence in notify,
+        // either the caller sees the new state or notify sees the flag cleared.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    template <typename Pred>
+    void wait(Pred pred)
+    {
+        while (!pred()) {
+            arm();
+            if (pred()) {
+                return;
+            }
+            poll_for(-1);
+        }
+    }
+
+    template <typename Pred, typename Clock, typename Duration>
+    bool wait_until(Pred pred, const std::chrono::time_point<Clock, Duration> &deadline)
+    {
+        while (!pred()) {
+            arm();
+            if (pred()) {
+                return true;
+            }
+            auto now{ Clock::now() };
+            if (now >= deadline) {
+                return false;
+            }
+            // Round up, poll would spin on a timeout below a millisecond.
+            auto left{ deadline - now + std::chrono::microseconds(999) };
+            auto ms{ std::chrono::duration_cast<std::chrono::milliseconds>(left) };
+            poll_for((int)(ms.count() < INT_MAX ? ms.count() : INT_MAX));
+        }
+        return true;
+    }
+
+    void notify() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (signaled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (!signaled_.exchange(true, std::memory_order_acq_rel)) {
+            uint64_t one{ 1 };
+            auto written = ::write(fd_, &one, sizeof(one));
+            (void)written;
+        }
+    }
+};
+#endif
+} // namespace t2
+
+#endif // WAIT_STRATEGY_HPP